@@ -18,6 +18,7 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 #include <pthread.h>
 #include <signal.h>
@@ -29,14 +30,24 @@
 #define GAP_DEFAULT   4096
 #define GAP_GROW      8192
 
+struct PieceTable;
+
 typedef struct {
     char   *buf;
     size_t  gap_start;
     size_t  gap_end;
     size_t  cap;
+    struct PieceTable *pt;   /* non-NULL: piece-table backend, buf unused */
 } GapBuf;
 
+/* Iterator over the contiguous runs covering a byte range */
+typedef struct {
+    const GapBuf *g;
+    size_t pos, end;
+} GbIter;
+
 GapBuf *gb_new(size_t cap);
+GapBuf *gb_new_mapped(const char *data, size_t len);
 void    gb_free(GapBuf *g);
 size_t  gb_len(const GapBuf *g);
 char    gb_at(const GapBuf *g, size_t i);
@@ -46,51 +57,170 @@ void    gb_insert_str(GapBuf *g, size_t pos, const char *s, size_t n);
 void    gb_delete(GapBuf *g, size_t pos, size_t n);
 char   *gb_to_str(const GapBuf *g);
 void    gb_get_range(const GapBuf *g, size_t start, size_t len, char *out);
+size_t  gb_chunk(const GapBuf *g, size_t pos, const char **out);
+void    gb_iter(GbIter *it, const GapBuf *g, size_t a, size_t b);
+size_t  gb_iter_next(GbIter *it, const char **p);
+const char *gb_span(const GapBuf *g, size_t pos, size_t len,
+                    char **scratch, size_t *scap);
+GapBuf *gb_clone(const GapBuf *g);
+bool    gb_write(const GapBuf *g, int fd, bool crlf);
+
+/* ─── Piece Table ────────────────────────────────────────────── */
+/* Files of at least PT_MAP_THRESHOLD bytes stay mmap'd read-only and
+   are edited through pieces instead of being copied into a gap. */
+#define PT_MAP_THRESHOLD (1u << 20)
+
+typedef enum { PIECE_ORIG, PIECE_ADD } PieceSource;
+
+typedef struct {
+    PieceSource src;
+    size_t      start;
+    size_t      len;
+} Piece;
+
+typedef struct {
+    const char *data;    /* read-only mapping of the original file */
+    size_t      len;
+    int         refs;    /* shared with undo snapshots */
+} PtOrig;
+
+typedef struct PieceTable {
+    PtOrig *orig;
+    char   *add;         /* append-only add buffer */
+    size_t  add_len;
+    size_t  add_cap;
+    Piece  *pieces;
+    size_t *offs;        /* document offset of each piece */
+    size_t  npieces;
+    size_t  pcap;
+    size_t  len;
+} PieceTable;
+
+PieceTable *pt_new_mapped(const char *data, size_t len);
+PieceTable *pt_clone(const PieceTable *pt);
+void        pt_free(PieceTable *pt);
+char        pt_at(const PieceTable *pt, size_t i);
+void        pt_insert(PieceTable *pt, size_t pos, const char *s, size_t n);
+void        pt_delete(PieceTable *pt, size_t pos, size_t n);
+void        pt_get_range(const PieceTable *pt, size_t start, size_t len, char *out);
+size_t      pt_chunk(const PieceTable *pt, size_t pos, const char **out);
 
 /* ─── Line Index ─────────────────────────────────────────────── */
 #define LINE_IDX_CHUNK 1024
 
 typedef struct {
-    size_t *offsets;
+    size_t *starts;      /* relative to the block, starts[0] == 0 */
     size_t  count;
-    size_t  cap;
-    bool    dirty;
+    size_t  bytes;       /* bytes up to the next block */
+} LineBlock;
+
+typedef struct {
+    LineBlock *blocks;
+    size_t     nblocks;
+    size_t     bcap;
+    size_t    *fw_lines; /* Fenwick trees of per-block lines / bytes */
+    size_t    *fw_bytes;
+    size_t     count;
+    bool       dirty;
+    struct LiBuild *bg;  /* non-NULL while a worker is still indexing */
 } LineIdx;
 
 LineIdx *li_new(void);
 void     li_free(LineIdx *li);
 void     li_rebuild(LineIdx *li, const GapBuf *g);
+void     li_edit(LineIdx *li, const GapBuf *g, size_t pos,
+                 size_t removed, size_t inserted);
 size_t   li_line_start(const LineIdx *li, size_t line);
+size_t   li_line_of(const LineIdx *li, size_t pos);
 size_t   li_line_count(const LineIdx *li);
 void     li_mark_dirty(LineIdx *li);
+size_t   li_line_end(const LineIdx *li, size_t line, const GapBuf *g);
+void     li_build_async(LineIdx *li, const char *data, size_t len);
+void     li_poll(LineIdx *li);
+void     li_wait(LineIdx *li);
+void     li_cancel(LineIdx *li);
+bool     li_covers(const LineIdx *li, size_t pos);
+int      li_progress(const LineIdx *li);
+const char *li_set_scan(const char *name);
+
+/* ─── Arena Allocator ────────────────────────────────────────── */
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t used;
+    size_t cap;
+    char   data[];
+} ArenaBlock;
+
+typedef struct { ArenaBlock *head; } Arena;
+
+typedef struct { ArenaBlock *block; size_t used; } ArenaMark;
+
+Arena    *arena_new(size_t block_size);
+void     *arena_alloc(Arena *a, size_t n);
+void      arena_free(Arena *a);
+ArenaMark arena_mark(const Arena *a);
+void      arena_release(Arena *a, ArenaMark m);
 
 /* ─── Undo/Redo ──────────────────────────────────────────────── */
-typedef enum { PIECE_ORIG, PIECE_ADD } PieceSource;
+#define UNDO_COALESCE_MS 1000
 
+/* One edit: [pos, pos+del_len) was replaced by ins[0..ins_len). */
 typedef struct {
-    PieceSource src;
-    size_t      start;
-    size_t      len;
-} Piece;
-
-typedef struct UndoAction {
-    GapBuf             *snapshot_buf;
-    size_t              cursor_pos;
-    struct UndoAction  *prev;
-    struct UndoAction  *next;
-} UndoAction;
+    size_t    pos;
+    char     *del;
+    size_t    del_len;
+    char     *ins;
+    size_t    ins_len;
+    size_t    cursor_before;
+    size_t    cursor_after;
+    ArenaMark mark;          /* arena position before this record's text */
+    size_t    size;          /* arena bytes taken by this record */
+    size_t    cap;           /* room in the text that typing extends */
+    bool      typed;         /* later keystrokes may merge into it */
+    bool      chain;         /* undone together with the previous record */
+} UndoRec;
 
 typedef struct {
-    UndoAction *head;
-    UndoAction *current;
-    int         depth;
+    UndoRec *recs;           /* recs[0..current) are applied */
+    size_t   count;
+    size_t   cap;
+    size_t   current;
+    Arena   *arena;          /* text of every record */
+    size_t   used;           /* bytes handed out by the arena */
+    size_t   live;           /* bytes still referenced by recs */
+    int      depth;          /* open us_begin() nesting */
+    size_t   group;          /* first record of the open transaction */
+    long     last_ms;        /* when the top record was last typed into */
+    const char *jmap;        /* journal mapping backing restored records */
+    size_t   jmap_len;
+    size_t   base;           /* journal index of recs[0] */
+    size_t   synced;         /* recs[0..synced) are in the journal */
+    bool     journaled;      /* on-disk journal matches base/synced */
+    struct UjCheck *check;   /* journal waiting for the text hash */
 } UndoStack;
 
-UndoStack *us_new(void);
-void       us_free(UndoStack *us);
-void       us_push(UndoStack *us, const GapBuf *g, size_t cursor);
-bool       us_undo(UndoStack *us, GapBuf **g_out, size_t *cursor_out);
-bool       us_redo(UndoStack *us, GapBuf **g_out, size_t *cursor_out);
+typedef struct UjWrite UjWrite;
+
+UndoStack     *us_new(void);
+void           us_free(UndoStack *us);
+void           us_push(UndoStack *us, const GapBuf *g, size_t pos, size_t del,
+                       const char *ins, size_t ins_len,
+                       size_t cursor_before, size_t cursor_after);
+void           us_type(UndoStack *us, const GapBuf *g, size_t pos, size_t del,
+                       const char *ins, size_t ins_len,
+                       size_t cursor_before, size_t cursor_after);
+void           us_begin(UndoStack *us);
+void           us_end(UndoStack *us);
+const UndoRec *us_undo(UndoStack *us, size_t *n);
+const UndoRec *us_redo(UndoStack *us, size_t *n);
+void           us_load(UndoStack *us, const char *path, const GapBuf *g);
+bool           us_poll(UndoStack *us);
+UjWrite       *us_save(UndoStack *us, const char *path, const GapBuf *g);
+UjWrite       *us_save_merge(UjWrite *older, UjWrite *w);
+void           us_save_finish(UjWrite *w, const char *path, const GapBuf *snap,
+                              bool saved);
+void           us_save_drop(UjWrite *w);
+void           us_forget(const char *path);
 
 /* ─── Syntax / Lexer ─────────────────────────────────────────── */
 typedef enum {
@@ -116,41 +246,131 @@ typedef enum {
     LANG_NONE
 } Language;
 
+#define SYN_RENDER_WAIT_MS 8    /* longest a frame waits for the highlighter */
+#define SYN_CKPT_LINES     256  /* lines between lex-state checkpoints */
+
 typedef struct {
-    TokenType *attrs;
-    size_t     len;
+    uint8_t   *runs;            /* token runs, read with syn_run */
+    uint32_t   runs_len;
+    uint32_t   runs_cap;        /* arena bytes behind runs */
+    size_t     len;             /* bytes covered by runs */
     bool       dirty;
+    bool       approx;          /* lexed from a guessed state, shown until redone */
     int        lex_state_start;
     int        lex_state_end;
 } LineAttr;
 
+/* Next token run of a line: one byte with the token in the high nibble
+   and the length in the low one, or a zero length and then the length as
+   a varint.  Returns the token and adds its length to *end. */
+static inline TokenType syn_run(const uint8_t **p, size_t *end) {
+    uint8_t b = *(*p)++;
+    size_t  n = b & 15;
+    if (!n) {
+        for (int sh = 0; ; sh += 7) {
+            uint8_t c = *(*p)++;
+            n |= (size_t)(c & 0x7f) << sh;
+            if (!(c & 0x80)) break;
+        }
+    }
+    *end += n;
+    return (TokenType)(b >> 4);
+}
+
+/* Lex state at the start of a line */
+typedef struct {
+    size_t line;
+    int    state;
+} SynCkpt;
+
 typedef struct {
-    LineAttr  *lines;
+    LineAttr  *lines;           /* gap array: use syn_line */
     size_t     count;
     size_t     cap;
+    size_t     gap;
     Language   lang;
-    char       search_word[256];
+    SynCkpt   *ckpt;            /* sorted by line, ckpt[0] is line 0 */
+    size_t     nckpt, ckcap;
+    size_t     frontier;        /* entry states known up to this line */
+    int        front_state;
+    size_t     horizon;         /* states from before the edits hold up to here */
+    int        horizon_state;
+    size_t     dirty_hi;        /* end of the lines edited since then */
+    Arena     *arena;           /* token runs of every line */
+    size_t     used;            /* bytes handed out by the arena */
+    size_t     live;            /* bytes still behind a line */
+    struct SynScratch *scratch; /* lexing buffers of syn_ensure_line */
+    /* Background highlighter: lines and the buffer it reads are guarded
+       by mu; whoever edits the buffer or line index holds syn_lock */
+    pthread_t       thread;
+    pthread_mutex_t mu;
+    pthread_cond_t  wake, done;
+    bool            running, quit, busy;
+    uint64_t        version;        /* bumped by every invalidation */
+    const GapBuf   *g;
+    const LineIdx  *li;
+    size_t          view_lo, view_hi;
 } SynCtx;
 
 SynCtx  *syn_new(Language lang);
 void     syn_free(SynCtx *s);
 void     syn_mark_dirty_from(SynCtx *s, size_t line);
+void     syn_edit(SynCtx *s, size_t line, size_t old_n, size_t new_n);
 void     syn_ensure_line(SynCtx *s, size_t line, const GapBuf *g,
                          const LineIdx *li);
+void     syn_view(SynCtx *s, const GapBuf *g, const LineIdx *li,
+                  size_t lo, size_t hi, int wait_ms);
+bool     syn_busy(SynCtx *s);
+LineAttr *syn_line(SynCtx *s, size_t line);
+void     syn_lock(SynCtx *s);
+void     syn_unlock(SynCtx *s);
 Language lang_from_ext(const char *ext);
 TokenType syn_search_tok(TokenType base);
 
+/* ─── Regex ──────────────────────────────────────────────────── */
+typedef struct Regex Regex;
+
+Regex *re_compile(const char *pat, const char **err);
+void   re_free(Regex *re);
+int    re_groups(const Regex *re);
+bool   re_search(Regex *re, const GapBuf *g, size_t from, size_t limit,
+                 size_t *start, size_t *end);
+bool   re_search_in(Regex *re, const char *text, size_t len, size_t from,
+                    size_t *start, size_t *end);
+bool   re_captures(Regex *re, const GapBuf *g, size_t start, size_t end,
+                   size_t *caps);
+
 /* ─── Search ─────────────────────────────────────────────────── */
+typedef struct SearchJob SearchJob;
+
 typedef struct {
     char    query[256];
     size_t *matches;
     size_t  count;
     size_t  cap;
     int     current;
+    /* Incremental search: matches[ref..todo) of the previous query are
+       refined first, then g[pos, len) is scanned */
+    bool    pending;
+    size_t  ref, todo;
+    size_t  pos;
+    size_t  next;       /* earliest start of the next match */
+    bool    regex;      /* query is a regular expression */
+    Regex  *re;
+    const char *err;    /* why the regex did not compile */
+    bool    overlap;    /* every occurrence, even overlapping ones */
+    SearchJob *job;     /* workers scanning a large buffer */
 } SearchCtx;
 
 void search_find(SearchCtx *sc, const GapBuf *g);
+void search_start(SearchCtx *sc, const char *query);
+bool search_step(SearchCtx *sc, const GapBuf *g);
+size_t search_next_in(const SearchCtx *sc, const GapBuf *g, size_t base,
+                      const char *text, size_t len, size_t from, size_t *end);
+void search_cancel(SearchCtx *sc);
 void search_clear(SearchCtx *sc);
+const char *search_set_kernel(const char *name);
+int  search_set_threads(int n);
 
 /* ─── Clipboard ──────────────────────────────────────────────── */
 typedef struct {
@@ -170,11 +390,9 @@ typedef struct {
     size_t    scroll_row;
     char      filename[4096];
     bool      modified;
-    /* Recherche ASCII */
-    char      search_query[256];
-    size_t   *search_results;
-    size_t    search_count;
-    size_t    search_current;
+    /* Recherche ASCII : data vue comme un gap buffer sans gap */
+    SearchCtx search;
+    GapBuf    view;
 } HexPane;
 
 HexPane *hex_new(void);
@@ -183,6 +401,7 @@ bool     hex_load(HexPane *h, const char *path);
 bool     hex_save(HexPane *h, const char *path);
 void     hex_scroll_to_cursor(HexPane *h, int win_h);
 void     hex_search_ascii(HexPane *h, const char *query);
+bool     hex_search_step(HexPane *h);
 void     hex_render(HexPane *h, WINDOW *win, int win_h, int win_w);
 bool     hex_handle_key(HexPane *h, int key, int win_h);
 void     hex_colors_init(void);
@@ -231,6 +450,7 @@ Pane *pane_new(void);
 void  pane_free(Pane *p);
 void  pane_open_file(Pane *p, const char *path);
 bool  pane_save_file(Pane *p, const char *path);
+int   pane_write_atomic(const char *path, const GapBuf *snap, bool crlf);
 void  pane_set_window(Pane *p, WINDOW *w, int y, int x, int h, int ww);
 void  pane_render(Pane *p, bool force);
 void  pane_insert_char(Pane *p, char c);
@@ -250,7 +470,8 @@ void  pane_paste(Pane *p);
 void  pane_search_next(Pane *p);
 void  pane_search_prev(Pane *p);
 void  pane_cursor_line_col(const Pane *p, size_t *line, size_t *col);
-void  pane_push_undo(Pane *p);
+void  pane_replace(Pane *p, size_t pos, size_t del, const char *ins, size_t n,
+                   size_t cursor_after);
 void  pane_wipe_file(Pane *p);
 void  pane_beautify(Pane *p);
 
@@ -328,12 +549,18 @@ typedef struct {
     bool       tree_focus;   /* true = focus sur le file tree */
     FileTree  *tree;
 
+    /* Save worker: one I/O thread writes queued snapshots in order */
     pthread_t  save_thread;
-    bool       save_pending;
-    char       save_path[4096];
-    char      *save_buf;
-    size_t     save_len;
+    bool       save_pending;     /* jobs queued or being written */
+    bool       save_report;      /* save_msg changed since last drawn */
+    bool       save_quit;
+    char       save_path[4096];  /* file of the last finished save */
+    char       save_msg[256];    /* its outcome, for the status bar */
+    struct SaveJob *save_queue;
+    struct SaveJob *save_active;  /* being written */
     pthread_mutex_t save_mutex;
+    pthread_cond_t  save_cond;
+    pthread_cond_t  save_done;    /* save_active finished */
 } Editor;
 
 extern Editor E;
@@ -345,6 +572,8 @@ void editor_split(void);
 void editor_close_split(void);
 void editor_focus_next(void);
 void editor_resize_panes(void);
+void editor_queue_save(const char *path, GapBuf *snap, bool crlf, UjWrite *uj);
+void editor_drop_saves(const char *path);
 
 /* ─── Run / Build ────────────────────────────────────────────── */
 void run_file(const char *path, Language lang, char *out_buf, size_t out_max);
@@ -383,20 +612,6 @@ void run_async(const char *path, Language lang);
 void colors_init(void);
 int  tok_to_color_pair(TokenType t);
 
-/* ─── Arena Allocator ────────────────────────────────────────── */
-typedef struct ArenaBlock {
-    struct ArenaBlock *next;
-    size_t used;
-    size_t cap;
-    char   data[];
-} ArenaBlock;
-
-typedef struct { ArenaBlock *head; } Arena;
-
-Arena *arena_new(size_t block_size);
-void  *arena_alloc(Arena *a, size_t n);
-void   arena_free(Arena *a);
-
 /* ─── Utilities ──────────────────────────────────────────────── */
 static inline size_t min_sz(size_t a, size_t b) { return a < b ? a : b; }
 static inline size_t max_sz(size_t a, size_t b) { return a > b ? a : b; }
@@ -18,7 +18,8 @@
  *        PHP                       ->  #, //, and block comments
  *        JSON / Plain / unknown    ->  nothing stripped
  *
- * An undo snapshot is pushed before the transform so ^Z can revert it.
+ * Only the bytes removed are recorded, as a group of undo records that
+ * one ^Z reverts.
  */
 
 /* ------------------------------------------------------------------
@@ -275,33 +276,87 @@ static void beautify_buf(const char *src, size_t slen,
 }
 
 /* ------------------------------------------------------------------
- * 4.  Public entry point (called from editor.c)
+ * 4.  Hunks: the edit as a few replacements
+ * ------------------------------------------------------------------ */
+
+#define BEAUTIFY_HUNKS 64   /* undo records per beautify, at most */
+
+typedef struct { size_t a, b, da, db; } Hunk;   /* src[a,b) -> dst[da,db) */
+
+/* dst only ever drops bytes of src: find the dropped runs, then merge
+   neighbours across the shortest kept spans until at most BEAUTIFY_HUNKS
+   remain.  Falls back to one hunk for the whole text if dst is not a
+   subsequence of src. */
+static size_t find_hunks(const char *src, size_t slen,
+                         const char *dst, size_t dlen, Hunk **out)
+{
+    Hunk  *h = NULL;
+    size_t n = 0, cap = 0, i = 0, j = 0;
+    while (i < slen) {
+        if (j < dlen && src[i] == dst[j]) { i++; j++; continue; }
+        size_t a = i;
+        while (i < slen && (j >= dlen || src[i] != dst[j])) i++;
+        if (n == cap) {
+            cap = cap ? cap * 2 : 64;
+            h = realloc(h, cap * sizeof *h);
+        }
+        h[n++] = (Hunk){ a, i, j, j };
+    }
+    if (j < dlen) {
+        h = realloc(h, sizeof *h);
+        h[0] = (Hunk){ 0, slen, 0, dlen };
+        n = 1;
+    }
+    for (size_t gap = 1; n > BEAUTIFY_HUNKS; gap *= 2) {
+        size_t k = 0;
+        for (size_t m = 1; m < n; m++) {
+            if (h[m].a - h[k].b < gap) { h[k].b = h[m].b; h[k].db = h[m].db; }
+            else h[++k] = h[m];
+        }
+        n = k + 1;
+    }
+    *out = h;
+    return n;
+}
+
+/* ------------------------------------------------------------------
+ * 5.  Public entry point (called from editor.c)
  * ------------------------------------------------------------------ */
 
 void pane_beautify(Pane *p)
 {
     if (!p || p->hex_mode) return;
 
-    char  *src  = gb_to_str(p->buf);
+    /* With the gap moved to the end the text is one span, read in place
+       (a mapped piece table still needs a copy) */
     size_t slen = gb_len(p->buf);
+    search_cancel(&p->search);      /* search workers read the buffer */
+    syn_lock(p->syn);
+    gb_move_gap(p->buf, slen);
+    syn_unlock(p->syn);
+    char  *scratch = NULL;
+    size_t scap    = 0;
+    const char *src = gb_span(p->buf, 0, slen, &scratch, &scap);
 
     char  *dst  = NULL;
     size_t dlen = 0;
     beautify_buf(src, slen, style_for_lang(p->lang), &dst, &dlen);
-    free(src);
+    Hunk  *h = NULL;
+    size_t n = find_hunks(src, slen, dst, dlen, &h);
+    free(scratch);
+
+    /* The cursor moves back by what the hunks before it drop */
+    size_t cur = p->cursor;
+    for (size_t k = 0; k < n && h[k].a < p->cursor; k++) {
+        size_t len = min_sz(p->cursor, h[k].b) - h[k].a;
+        cur -= len - min_sz(len, h[k].db - h[k].da);
+    }
 
-    /* Replace the gap buffer */
-    gb_free(p->buf);
-    p->buf = gb_new(dlen + GAP_DEFAULT);
-    if (dlen > 0)
-        gb_insert_str(p->buf, 0, dst, dlen);
+    /* Back to front, so the offsets of the hunks left stay valid */
+    us_begin(p->undo);
+    for (size_t k = n; k-- > 0; )
+        pane_replace(p, h[k].a, h[k].b - h[k].a, dst + h[k].da, h[k].db - h[k].da, cur);
+    us_end(p->undo);
+    free(h);
     free(dst);
-
-    if (p->cursor > dlen) p->cursor = dlen;
-
-    li_rebuild(p->li, p->buf);
-    syn_mark_dirty_from(p->syn, 0);
-    p->modified = true;
-
-    pane_push_undo(p);
 }
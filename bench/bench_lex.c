@@ -0,0 +1,227 @@
+/*
+ * bench_lex.c  --  syntax highlighting throughput
+ *
+ *   make bench-lex                   32 MB of each synthetic corpus
+ *   bench/bench_lex -m 128           128 MB of each
+ *   bench/bench_lex FILE...          lex FILEs, language from the extension
+ *
+ * Loads each corpus into a gap buffer (gap in the middle), indexes it,
+ * then times syn_ensure_line over every line in order, the way the
+ * highlighter walks a file.  Reports lines/s, MB/s and the allocations
+ * made per line while lexing.
+ */
+#include "../abyss.h"
+#include <stdarg.h>
+
+/* Allocations are counted through -Wl,--wrap (see the Makefile) */
+static size_t nalloc;
+void *__real_malloc(size_t n);
+void *__real_calloc(size_t n, size_t m);
+void *__real_realloc(void *p, size_t n);
+void *__wrap_malloc(size_t n)             { nalloc++; return __real_malloc(n); }
+void *__wrap_calloc(size_t n, size_t m)   { nalloc++; return __real_calloc(n, m); }
+void *__wrap_realloc(void *p, size_t n)   { nalloc++; return __real_realloc(p, n); }
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* ─── Corpora ────────────────────────────────────────────────── */
+
+typedef struct {
+    char  *s;
+    size_t len, cap;
+    uint32_t x;
+} Out;
+
+static void put(Out *o, const char *fmt, ...) {
+    va_list ap;
+    for (;;) {
+        va_start(ap, fmt);
+        int n = vsnprintf(o->s + o->len, o->cap - o->len, fmt, ap);
+        va_end(ap);
+        if (o->len + (size_t)n < o->cap) { o->len += (size_t)n; return; }
+        o->cap = 2 * o->cap + (size_t)n;
+        o->s = realloc(o->s, o->cap);
+    }
+}
+
+static uint32_t rnd(Out *o, uint32_t n) {
+    o->x ^= o->x << 13; o->x ^= o->x >> 17; o->x ^= o->x << 5;
+    return o->x % n;
+}
+
+static const char *words[] = {
+    "count", "buf", "node", "value", "index", "result", "len", "ptr",
+    "state", "next", "item", "data", "size", "left", "right", "key",
+};
+#define WORD(o) words[rnd(o, sizeof words / sizeof *words)]
+
+/* Large C: functions with comments, strings, macros and numbers */
+static void gen_c(Out *o, size_t len) {
+    for (int f = 0; o->len < len; f++) {
+        if (f % 8 == 0) put(o, "#include <stdio.h>\n#define MAX_%d (%d * 4)\n\n", f, f);
+        put(o, "/*\n * %s_%d: walks the %s list\n */\n", WORD(o), f, WORD(o));
+        put(o, "static int %s_%d(struct %s *%s, size_t %s) {\n", WORD(o), f, WORD(o), WORD(o), WORD(o));
+        for (int l = (int)rnd(o, 12); l >= 0; l--) {
+            switch (rnd(o, 4)) {
+            case 0: put(o, "    if (%s->%s > 0x%x) return -1; // %s\n", WORD(o), WORD(o), rnd(o, 65536), WORD(o)); break;
+            case 1: put(o, "    printf(\"%s=%%d\\n\", %s[%u]);\n", WORD(o), WORD(o), rnd(o, 100)); break;
+            case 2: put(o, "    for (int i = 0; i < %s; i++) %s += %s * 3.5;\n", WORD(o), WORD(o), WORD(o)); break;
+            case 3: put(o, "    char c = '%c'; unsigned long %s = %s;\n", 'a' + rnd(o, 26), WORD(o), WORD(o)); break;
+            }
+        }
+        put(o, "    return 0;\n}\n\n");
+    }
+}
+
+/* Minified JS: few, very long lines */
+static void gen_js(Out *o, size_t len) {
+    while (o->len < len) {
+        size_t end = o->len + 64 * 1024;
+        put(o, "!function(e){");
+        while (o->len < end)
+            switch (rnd(o, 4)) {
+            case 0: put(o, "var %s=e.%s||{};", WORD(o), WORD(o)); break;
+            case 1: put(o, "if(%s<%u){return \"%s\"}", WORD(o), rnd(o, 1000), WORD(o)); break;
+            case 2: put(o, "function %c(t,n){return t[n]+%u}", 'a' + rnd(o, 26), rnd(o, 99)); break;
+            case 3: put(o, "for(let i=0;i<%s.length;i++)%s.push(/x/.test(i));", WORD(o), WORD(o)); break;
+            }
+        put(o, "}(window);\n");
+    }
+}
+
+/* Deeply nested Python with docstrings */
+static void gen_py(Out *o, size_t len) {
+    while (o->len < len) {
+        put(o, "class %s_%u(object):\n    \"\"\"Holds the %s.\n\n    More about %s.\n    \"\"\"\n",
+            WORD(o), rnd(o, 1000), WORD(o), WORD(o));
+        int depth = 1;
+        for (int l = 0; l < 40; l++) {
+            const char *pad = "                                                ";
+            int ind = 4 * depth;
+            switch (rnd(o, 5)) {
+            case 0: put(o, "%.*sdef %s(self, %s=None):\n", ind, pad, WORD(o), WORD(o)); depth++; break;
+            case 1: put(o, "%.*sif %s is not None and %s > %u:\n", ind, pad, WORD(o), WORD(o), rnd(o, 50)); depth++; break;
+            case 2: put(o, "%.*s%s = '%s' + f\"{%s}\"  # %s\n", ind, pad, WORD(o), WORD(o), WORD(o), WORD(o)); break;
+            case 3: put(o, "%.*sreturn [%s for %s in range(%u)]\n", ind, pad, WORD(o), WORD(o), rnd(o, 9)); break;
+            case 4: put(o, "%.*sself.%s += %u.5\n", ind, pad, WORD(o), rnd(o, 100)); break;
+            }
+            if (depth > 10 || rnd(o, 6) == 0) depth = 1 + (int)rnd(o, (uint32_t)depth);
+        }
+        put(o, "\n");
+    }
+}
+
+/* SQL dump: long INSERT lines */
+static void gen_sql(Out *o, size_t len) {
+    put(o, "-- dump\nCREATE TABLE %s (id INT PRIMARY KEY, name VARCHAR(64), score REAL);\n", WORD(o));
+    while (o->len < len) {
+        put(o, "INSERT INTO %s VALUES ", WORD(o));
+        for (int r = 0; r < 200; r++)
+            put(o, "%s(%u,'%s %s',%u.%u)", r ? "," : "", rnd(o, 1u << 30), WORD(o), WORD(o), rnd(o, 100), rnd(o, 100));
+        put(o, ";\n");
+    }
+}
+
+static void gen_json(Out *o, size_t len) {
+    put(o, "[\n");
+    while (o->len < len)
+        put(o, "  {\"%s\": %u, \"%s\": \"%s\", \"ok\": %s, \"v\": [-%u.5e3, null]},\n",
+            WORD(o), rnd(o, 1000), WORD(o), WORD(o), rnd(o, 2) ? "true" : "false", rnd(o, 9));
+    put(o, "  {}\n]\n");
+}
+
+static void gen_html(Out *o, size_t len) {
+    put(o, "<!DOCTYPE html>\n<html>\n<body>\n");
+    while (o->len < len) {
+        put(o, "<div class=\"%s\" id='%s%u'>\n  <!-- %s -->\n", WORD(o), WORD(o), rnd(o, 1000), WORD(o));
+        put(o, "  <p>The %s &amp; the %s are <b>%s</b>.</p>\n</div>\n", WORD(o), WORD(o), WORD(o));
+    }
+    put(o, "</body>\n</html>\n");
+}
+
+static void gen_css(Out *o, size_t len) {
+    while (o->len < len) {
+        put(o, "/* %s */\n.%s > #%s:hover, %s {\n", WORD(o), WORD(o), WORD(o), WORD(o));
+        put(o, "  margin: %upx %uem;\n  color: #%06x !important;\n  font-family: \"%s\", sans-serif;\n}\n",
+            rnd(o, 40), rnd(o, 4), rnd(o, 1u << 24), WORD(o));
+    }
+}
+
+static const struct {
+    const char *name;
+    Language    lang;
+    void      (*gen)(Out *, size_t);
+} corpora[] = {
+    { "c",    LANG_C,    gen_c    },
+    { "js",   LANG_JS,   gen_js   },
+    { "py",   LANG_PY,   gen_py   },
+    { "sql",  LANG_SQL,  gen_sql  },
+    { "json", LANG_JSON, gen_json },
+    { "html", LANG_HTML, gen_html },
+    { "css",  LANG_CSS,  gen_css  },
+};
+
+/* ─── Driver ─────────────────────────────────────────────────── */
+
+static void run(const char *name, Language lang, const char *text, size_t len) {
+    GapBuf *g = gb_new(len + GAP_DEFAULT);
+    gb_insert_str(g, 0, text, len);
+    gb_move_gap(g, len / 2);
+    LineIdx *li = li_new();
+    li_rebuild(li, g);
+    li_wait(li);
+    size_t lines = li_line_count(li);
+
+    SynCtx *s = syn_new(lang);
+    size_t a0 = nalloc;
+    double t = now_s();
+    for (size_t i = 0; i < lines; i++) syn_ensure_line(s, i, g, li);
+    double secs = now_s() - t;
+    size_t allocs = nalloc - a0;
+
+    printf("  %-6s %8.1f MB %9zu lines %7.3f s  %9.0f lines/s  %7.1f MB/s  %.4f allocs/line\n",
+           name, len / 1048576.0, lines, secs, lines / secs,
+           len / secs / 1048576.0, (double)allocs / (double)lines);
+    syn_free(s);
+    li_free(li);
+    gb_free(g);
+}
+
+int main(int argc, char **argv) {
+    size_t mb = 32;
+    int nfiles = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-m") && i + 1 < argc) { mb = strtoul(argv[++i], NULL, 10); continue; }
+        const char *path = argv[i];
+        int fd = open(path, O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) < 0) { perror(path); return 1; }
+        size_t len = (size_t)st.st_size, got = 0;
+        char *text = malloc(len ? len : 1);
+        while (got < len) {
+            ssize_t r = read(fd, text + got, len - got);
+            if (r <= 0) break;
+            got += (size_t)r;
+        }
+        close(fd);
+        const char *ext = strrchr(path, '.');
+        if (!nfiles++) printf("lexing:\n");
+        run(path, lang_from_ext(ext ? ext : ""), text, got);
+        free(text);
+    }
+    if (nfiles) return 0;
+
+    printf("lexing: %zu MB of each corpus\n", mb);
+    for (size_t k = 0; k < sizeof corpora / sizeof *corpora; k++) {
+        Out o = { .cap = 1 << 20, .x = 2463534242u };
+        o.s = malloc(o.cap);
+        corpora[k].gen(&o, mb << 20);
+        run(corpora[k].name, corpora[k].lang, o.s, o.len);
+        free(o.s);
+    }
+    return 0;
+}
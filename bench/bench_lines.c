@@ -0,0 +1,107 @@
+/*
+ * bench_lines.c  --  line indexing throughput
+ *
+ *   make bench-lines                 256 MB of synthetic text
+ *   bench/bench_lines FILE           index FILE instead
+ *   bench/bench_lines -m 1024        1 GB of synthetic text
+ *
+ * Times li_rebuild with every newline kernel the CPU supports, over a
+ * gap buffer whose gap sits in the middle (two segments) and over a
+ * mapped piece table, next to the old byte-at-a-time gb_at loop.
+ */
+#include "../abyss.h"
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static char *synth(size_t len) {
+    char *s = malloc(len);
+    uint32_t x = 2463534242u;
+    size_t i = 0;
+    while (i < len) {
+        x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+        size_t ll = x % 120;
+        for (size_t j = 0; j < ll && i < len; j++) s[i++] = 'a' + (char)(j % 26);
+        if (i < len) s[i++] = '\n';
+    }
+    return s;
+}
+
+static size_t bytewise(const GapBuf *g) {
+    size_t n = 1, len = gb_len(g);
+    for (size_t i = 0; i < len; i++) if (gb_at(g, i) == '\n') n++;
+    return n;
+}
+
+static void report(const char *what, const char *kern, size_t bytes,
+                   double secs, size_t lines) {
+    printf("  %-8s %-8s %8.3f s  %7.2f GB/s  %zu lines\n",
+           what, kern, secs, bytes / secs / 1e9, lines);
+}
+
+int main(int argc, char **argv) {
+    size_t mb = 256;
+    const char *path = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-m") && i + 1 < argc) mb = strtoul(argv[++i], NULL, 10);
+        else path = argv[i];
+    }
+
+    char *text; size_t len;
+    if (path) {
+        int fd = open(path, O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) < 0) { perror(path); return 1; }
+        len  = (size_t)st.st_size;
+        text = malloc(len);
+        size_t got = 0;
+        while (got < len) {
+            ssize_t r = read(fd, text + got, len - got);
+            if (r <= 0) break;
+            got += (size_t)r;
+        }
+        close(fd);
+        len = got;
+    } else {
+        len  = mb << 20;
+        text = synth(len);
+    }
+    printf("line index: %.1f MB %s\n", len / 1048576.0, path ? path : "(synthetic)");
+
+    /* Gap buffer with the gap in the middle: two segments */
+    GapBuf *gap = gb_new(len + GAP_DEFAULT);
+    gb_insert_str(gap, 0, text, len);
+    gb_move_gap(gap, len / 2);
+
+    /* Piece table over an anonymous mapping of the same text */
+    char *map = mmap(NULL, len ? len : 1, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    memcpy(map, text, len);
+    GapBuf *pt = gb_new_mapped(map, len);
+    free(text);
+
+    double t = now_s();
+    size_t n = bytewise(gap);
+    report("gap", "gb_at", len, now_s() - t, n);
+
+    static const char *kernels[] = { "scalar", "sse2", "avx2" };
+    LineIdx *li = li_new();
+    for (size_t k = 0; k < sizeof kernels / sizeof kernels[0]; k++) {
+        const char *got = li_set_scan(kernels[k]);
+        if (strcmp(got, kernels[k])) { printf("  %-8s unsupported\n", kernels[k]); continue; }
+        for (int pass = 0; pass < 2; pass++) {
+            const GapBuf *g = pass ? pt : gap;
+            li_rebuild(li, g);                 /* warm up */
+            t = now_s();
+            li_rebuild(li, g);
+            report(pass ? "pieces" : "gap", got, len, now_s() - t, li_line_count(li));
+        }
+    }
+    li_free(li);
+    gb_free(gap);
+    gb_free(pt);
+    return 0;
+}
@@ -0,0 +1,109 @@
+/*
+ * bench_search.c  --  substring search throughput
+ *
+ *   make bench-search                256 MB of synthetic log
+ *   bench/bench_search FILE          search FILE instead
+ *   bench/bench_search -m 1024       1 GB of synthetic log
+ *   bench/bench_search -p PATTERN    count PATTERN only
+ *   bench/bench_search -t 8          8 workers in the parallel runs
+ *
+ * Counts every match with search_find over a gap buffer whose gap sits in
+ * the middle, once per search kernel the CPU supports (BMH first) on one
+ * thread, then with the best kernel on the worker pool.
+ */
+#include "../abyss.h"
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static char *synth(size_t len) {
+    static const char *lvl[]  = { "INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR" };
+    static const char *path[] = { "/api/v1/items", "/api/v1/users", "/static/app.js", "/health" };
+    char *s = malloc(len + 256);
+    uint32_t x = 2463534242u;
+    size_t i = 0;
+    while (i < len) {
+        x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+        i += (size_t)sprintf(s + i, "2026-10-16 %02u:%02u:%02u %-5s worker-%u GET %s id=%u took %ums%s\n",
+                             x % 24, x / 24 % 60, x / 1440 % 60, lvl[x % 6], x % 32,
+                             path[x / 7 % 4], x % 1000000, x / 3 % 900,
+                             x % 97 ? "" : " (connection reset by peer)");
+    }
+    return s;
+}
+
+static void report(const char *kern, int threads, const char *pat,
+                   size_t bytes, double secs, size_t count) {
+    printf("  %-5s x%-2d %-28s %8.3f s  %7.2f GB/s  %zu matches\n",
+           kern, threads, pat, secs, bytes / secs / 1e9, count);
+}
+
+static void run(GapBuf *g, const char *kern, int threads, const char *pat) {
+    SearchCtx sc = {0};
+    snprintf(sc.query, sizeof sc.query, "%s", pat);
+    search_find(&sc, g);                       /* warm up */
+    double t = now_s();
+    search_find(&sc, g);
+    report(kern, threads, sc.query, gb_len(g), now_s() - t, sc.count);
+    free(sc.matches);
+}
+
+int main(int argc, char **argv) {
+    size_t mb = 256;
+    const char *path = NULL, *only = NULL;
+    int threads = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-m") && i + 1 < argc) mb = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "-p") && i + 1 < argc) only = argv[++i];
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc) threads = atoi(argv[++i]);
+        else path = argv[i];
+    }
+
+    char *text; size_t len;
+    if (path) {
+        int fd = open(path, O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) < 0) { perror(path); return 1; }
+        len  = (size_t)st.st_size;
+        text = malloc(len);
+        size_t got = 0;
+        while (got < len) {
+            ssize_t r = read(fd, text + got, len - got);
+            if (r <= 0) break;
+            got += (size_t)r;
+        }
+        close(fd);
+        len = got;
+    } else {
+        len  = mb << 20;
+        text = synth(len);
+    }
+    printf("search: %.1f MB %s\n", len / 1048576.0, path ? path : "(synthetic)");
+
+    GapBuf *g = gb_new(len + GAP_DEFAULT);
+    gb_insert_str(g, 0, text, len);
+    gb_move_gap(g, len / 2);
+    free(text);
+
+    static const char *pats[] = {
+        "e", "id", "ERROR", "worker-17 GET", "connection reset by peer",
+        "never occurs in this log",
+    };
+    size_t npats = only ? 1 : sizeof pats / sizeof pats[0];
+    static const char *kernels[] = { "bmh", "sse2", "avx2" };
+    search_set_threads(1);
+    for (size_t k = 0; k < sizeof kernels / sizeof kernels[0]; k++) {
+        const char *got = search_set_kernel(kernels[k]);
+        if (strcmp(got, kernels[k])) { printf("  %-5s unsupported\n", kernels[k]); continue; }
+        for (size_t p = 0; p < npats; p++) run(g, got, 1, only ? only : pats[p]);
+    }
+    const char *best = search_set_kernel(NULL);
+    int n = search_set_threads(threads);
+    if (n > 1)
+        for (size_t p = 0; p < npats; p++) run(g, best, n, only ? only : pats[p]);
+    gb_free(g);
+    return 0;
+}
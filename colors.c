@@ -90,3 +90,17 @@ void arena_free(Arena *a) {
     while (b) { ArenaBlock *n = b->next; free(b); b = n; }
     free(a);
 }
+
+ArenaMark arena_mark(const Arena *a) {
+    return (ArenaMark){ a->head, a->head->used };
+}
+
+/* Drop everything allocated since m was taken. */
+void arena_release(Arena *a, ArenaMark m) {
+    while (a->head != m.block) {
+        ArenaBlock *n = a->head->next;
+        free(a->head);
+        a->head = n;
+    }
+    a->head->used = m.used;
+}
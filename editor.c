@@ -80,9 +80,12 @@ static void render_title(void) {
         bool mod = ap->hex_mode ? (ap->hex && ap->hex->modified) : ap->modified;
         const char *hex_tag  = ap->hex_mode ? "  [HEX]" : "";
         const char *tree_tag = (E.tree && E.tree->visible && E.tree_focus) ? "  [TREE]" : "";
+        char idx_tag[32] = "";
+        if (!ap->hex_mode && ap->li->bg)
+            snprintf(idx_tag, sizeof idx_tag, "  [indexed %d%%]", li_progress(ap->li));
         if (ap->filename[0])
-            wprintw(E.title_win, " Abyss  |  %s%s%s%s  |  ^A for shortcuts",
-                    ap->filename, mod ? " *" : "", hex_tag, tree_tag);
+            wprintw(E.title_win, " Abyss  |  %s%s%s%s%s  |  ^A for shortcuts",
+                    ap->filename, mod ? " *" : "", hex_tag, tree_tag, idx_tag);
         else
             wprintw(E.title_win, " Abyss  |  [No File]%s%s  |  ^A for shortcuts",
                     hex_tag, tree_tag);
@@ -118,15 +121,25 @@ static void render_status(void) {
         const char *lname = lang_names[ap->lang <= LANG_NONE ? ap->lang : LANG_NONE];
         size_t nlines = li_line_count(ap->li);
         char search_info[512] = "";
-        if (ap->search.query[0])
-            snprintf(search_info, sizeof search_info, " | \"%s\" [%d/%zu]",
+        if (ap->search.err)
+            snprintf(search_info, sizeof search_info, " | /%s/ %s",
+                     ap->search.query, ap->search.err);
+        else if (ap->search.query[0])
+            snprintf(search_info, sizeof search_info, " | \"%s\" [%d/%zu%s]",
                      ap->search.query,
                      ap->search.current >= 0 ? ap->search.current+1 : 0,
-                     ap->search.count);
+                     ap->search.count, ap->search.pending ? "+" : "");
         wprintw(E.status_win, " Ln %zu/%zu  Col %zu  [%s]%s%s ",
                 line+1, nlines, col+1, lname, search_info,
                 ap->show_line_numbers ? "  [LN]" : "");
     }
+
+    /* Outcome of the last background save */
+    pthread_mutex_lock(&E.save_mutex);
+    if (E.save_pending)      wprintw(E.status_win, " | Saving...");
+    else if (E.save_msg[0])  wprintw(E.status_win, " | %s", E.save_msg);
+    E.save_report = false;
+    pthread_mutex_unlock(&E.save_mutex);
     wclrtoeol(E.status_win);
     wattroff(E.status_win, COLOR_PAIR(COLOR_PAIR_STATUS));
     wnoutrefresh(E.status_win);
@@ -235,7 +248,11 @@ static void full_redraw(bool force) {
             "Jump to Offset  (decimal: 1024  or hex: 0x400)",
             "Search ASCII"
         };
-        render_dialog(titles[E.mode]);
+        const char *title = titles[E.mode];
+        if (E.mode == MODE_SEARCH_DIALOG)
+            title = E.panes[E.active]->search.regex ? "Search regex  (^R: literal)"
+                                                    : "Search  (^R: regex)";
+        render_dialog(title);
     }
     doupdate();
 }
@@ -288,18 +305,14 @@ static void dialog_confirm(void) {
         case MODE_HEX_SEARCH: {
             if (!ap->hex) { E.mode = MODE_NORMAL; return; }
             HexPane *h = ap->hex;
-            if (strcmp(E.dialog_buf, h->search_query) != 0) {
-                /* Nouvelle query → chercher et aller au premier résultat */
+            if (strcmp(E.dialog_buf, h->search.query) != 0) {
+                /* Nouvelle query → chercher ; la boucle principale va au
+                   premier résultat dès qu'il arrive */
                 hex_search_ascii(h, E.dialog_buf);
-                if (h->search_count > 0) {
-                    h->search_current = 0;
-                    h->cursor = h->search_results[0];
-                    hex_scroll_to_cursor(h, ap->win_h); /* ← scroll */
-                }
-            } else if (h->search_count > 0) {
+            } else if (h->search.count > 0) {
                 /* Même query → résultat suivant */
-                h->search_current = (h->search_current + 1) % h->search_count;
-                h->cursor = h->search_results[h->search_current];
+                h->search.current = (h->search.current + 1) % (int)h->search.count;
+                h->cursor = h->search.matches[h->search.current];
                 hex_scroll_to_cursor(h, ap->win_h); /* ← scroll */
             }
             /* Rester dans le dialog — Échap pour fermer */
@@ -313,29 +326,13 @@ static void dialog_confirm(void) {
             force_full_dirty();
             break;
         case MODE_OPEN_DIALOG:
-            gb_free(ap->buf);  ap->buf = gb_new(GAP_DEFAULT);
-            li_free(ap->li);   ap->li  = li_new();
-            syn_free(ap->syn); ap->syn = syn_new(LANG_C);
-            ap->cursor = 0;
             pane_open_file(ap, E.dialog_buf);
             layout_windows();
             force_full_dirty();
             break;
         case MODE_SEARCH_DIALOG:
-            if (strcmp(E.dialog_buf, ap->search.query) != 0) {
-                snprintf(ap->search.query, sizeof(ap->search.query), "%s", E.dialog_buf);
-                snprintf(ap->syn->search_word, sizeof(ap->syn->search_word), "%s", E.dialog_buf);
-                search_find(&ap->search, ap->buf);
-                syn_mark_dirty_from(ap->syn, 0);
-                if (ap->search.count > 0) {
-                    ap->search.current = 0;
-                    ap->cursor = ap->search.matches[0];
-                    li_rebuild(ap->li, ap->buf);
-                    pane_move_cursor(ap, 0, 0);
-                }
-            } else {
-                pane_search_next(ap);
-            }
+            /* La recherche suit la frappe → Entrée passe au suivant */
+            pane_search_next(ap);
             full_redraw(true); /* ← redraw */
             return; /* stay in dialog */
         case MODE_GOTO_LINE: {
@@ -389,10 +386,6 @@ static void handle_key_normal(int key) {
         if (open_path[0]) {
             /* Ouvrir le fichier dans le pane actif */
             Pane *ap2 = E.panes[E.active];
-            gb_free(ap2->buf);  ap2->buf = gb_new(GAP_DEFAULT);
-            li_free(ap2->li);   ap2->li  = li_new();
-            syn_free(ap2->syn); ap2->syn = syn_new(LANG_C);
-            ap2->cursor = 0;
             pane_open_file(ap2, open_path);
             /* Mettre à jour le cwd du tree vers le répertoire du fichier */
             char tmp[4096];
@@ -433,7 +426,7 @@ static void handle_key_normal(int key) {
         }
         if (key == ('f'&0x1f)) {
             open_dialog(MODE_HEX_SEARCH,
-                        ap->hex->search_query[0] ? ap->hex->search_query : NULL);
+                        ap->hex->search.query[0] ? ap->hex->search.query : NULL);
             return;
         }
         /* Tout le reste : navigation, Tab, nibbles, ASCII edit */
@@ -456,11 +449,7 @@ static void handle_key_normal(int key) {
             pane_move_cursor(ap, 0, 0); break;
         }
         case KEY_END: {
-            size_t nl = li_line_count(ap->li);
-            size_t le = (ap->cursor_line+1 < nl)
-                        ? li_line_start(ap->li, ap->cursor_line+1)-1
-                        : gb_len(ap->buf);
-            ap->cursor = le; pane_move_cursor(ap, 0, 0); break;
+            ap->cursor = li_line_end(ap->li, ap->cursor_line, ap->buf); pane_move_cursor(ap, 0, 0); break;
         }
         case KEY_BACKSPACE: case 127: case '\b': pane_delete_char(ap); break;
         case KEY_DC:  pane_delete_forward(ap); break;
@@ -484,6 +473,9 @@ static void handle_key_normal(int key) {
         case 'f'&0x1f:
             open_dialog(MODE_SEARCH_DIALOG,
                         ap->search.query[0] ? ap->search.query : NULL);
+            /* The buffer may have changed since: search the old query again */
+            search_clear(&ap->search);
+            search_start(&ap->search, E.dialog_buf);
             break;
         case 'n'&0x1f: pane_search_next(ap); break;
         case 'p'&0x1f: pane_search_prev(ap); break;
@@ -543,8 +535,6 @@ static void handle_key_normal(int key) {
             ap->sel_active = false;
             search_clear(&ap->search);
             ap->search.query[0] = '\0';
-            ap->syn->search_word[0] = '\0';
-            syn_mark_dirty_from(ap->syn, 0);
             break;
 
         default:
@@ -562,12 +552,21 @@ static void handle_key_dialog(int key) {
                 Pane *ap = E.panes[E.active];
                 search_clear(&ap->search);
                 ap->search.query[0] = '\0';
-                ap->syn->search_word[0] = '\0';
-                syn_mark_dirty_from(ap->syn, 0);
+            } else if (E.mode == MODE_HEX_SEARCH && E.panes[E.active]->hex) {
+                /* Arrêter la recherche, garder les résultats déjà trouvés */
+                search_cancel(&E.panes[E.active]->hex->search);
             }
             E.mode = MODE_NORMAL;
             break;
         case KEY_BACKSPACE: case 127: case '\b': dialog_backspace(); break;
+        case 'r'&0x1f:
+            /* Bascule texte / regex : on relance la recherche */
+            if (E.mode == MODE_SEARCH_DIALOG) {
+                Pane *ap = E.panes[E.active];
+                ap->search.regex = !ap->search.regex;
+                search_clear(&ap->search);
+            }
+            break;
         case KEY_LEFT:  if (E.dialog_cursor > 0) E.dialog_cursor--; break;
         case KEY_RIGHT:
             if (E.dialog_cursor < strlen(E.dialog_buf)) E.dialog_cursor++;
@@ -576,13 +575,120 @@ static void handle_key_dialog(int key) {
             if (key >= 32 && key < 127) dialog_insert((char)key);
             break;
     }
+    /* Search as you type; the scan itself runs from the main loop */
+    if (E.mode == MODE_SEARCH_DIALOG) {
+        Pane *ap = E.panes[E.active];
+        if (strcmp(E.dialog_buf, ap->search.query) != 0)
+            search_start(&ap->search, E.dialog_buf);
+    }
 }
 
 /* ─── Editor lifecycle ────────────────────────────────────────── */
 
+/* ─── Save worker ────────────────────────────────────────────── */
+/* Saves are written by a single I/O thread, one after the other, so two
+   quick ^S can never interleave.  A job still waiting in the queue is
+   superseded by a newer snapshot of the same file. */
+
+typedef struct SaveJob {
+    struct SaveJob *next;
+    char      path[4096];
+    GapBuf   *snap;
+    bool      crlf;
+    UjWrite  *journal;       /* undo journal frames, finished once written */
+    struct timespec queued;
+} SaveJob;
+
+static double ms_since(const struct timespec *t0) {
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (t1.tv_sec - t0->tv_sec) * 1e3 + (t1.tv_nsec - t0->tv_nsec) / 1e6;
+}
+
+static void *save_worker(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&E.save_mutex);
+    for (;;) {
+        while (!E.save_queue && !E.save_quit)
+            pthread_cond_wait(&E.save_cond, &E.save_mutex);
+        SaveJob *j = E.save_queue;
+        if (!j) break;
+        E.save_queue  = j->next;
+        E.save_active = j;
+        pthread_mutex_unlock(&E.save_mutex);
+
+        int err = pane_write_atomic(j->path, j->snap, j->crlf);
+        us_save_finish(j->journal, j->path, j->snap, !err);
+        size_t len = gb_len(j->snap);
+        gb_free(j->snap);
+
+        pthread_mutex_lock(&E.save_mutex);
+        snprintf(E.save_path, sizeof E.save_path, "%s", j->path);
+        const char *base = strrchr(j->path, '/');
+        base = base ? base + 1 : j->path;
+        if (err)
+            snprintf(E.save_msg, sizeof E.save_msg, "Save failed: %.160s: %s",
+                     base, strerror(err));
+        else
+            snprintf(E.save_msg, sizeof E.save_msg, "Saved %.160s (%zu bytes, %.1f ms)",
+                     base, len, ms_since(&j->queued));
+        E.save_pending = E.save_queue != NULL;
+        E.save_report  = true;
+        E.save_active  = NULL;
+        pthread_cond_broadcast(&E.save_done);
+        free(j);
+    }
+    pthread_mutex_unlock(&E.save_mutex);
+    return NULL;
+}
+
+/* Queue snap and uj (owned by the worker from now on) to be written to
+   path. */
+void editor_queue_save(const char *path, GapBuf *snap, bool crlf, UjWrite *uj) {
+    pthread_mutex_lock(&E.save_mutex);
+    SaveJob **jp = &E.save_queue;
+    while (*jp && strcmp((*jp)->path, path) != 0) jp = &(*jp)->next;
+    SaveJob *j = *jp;
+    if (j) {
+        gb_free(j->snap);
+    } else {
+        j = calloc(1, sizeof *j);
+        snprintf(j->path, sizeof j->path, "%s", path);
+        *jp = j;
+    }
+    j->snap = snap;
+    j->crlf = crlf;
+    j->journal = us_save_merge(j->journal, uj);
+    clock_gettime(CLOCK_MONOTONIC, &j->queued);
+    E.save_pending = true;
+    pthread_cond_signal(&E.save_cond);
+    pthread_mutex_unlock(&E.save_mutex);
+}
+
+/* Drop the saves of path still queued and wait out the one being
+   written: once this returns nothing writes path or its journal. */
+void editor_drop_saves(const char *path) {
+    pthread_mutex_lock(&E.save_mutex);
+    for (SaveJob **jp = &E.save_queue; *jp; ) {
+        SaveJob *j = *jp;
+        if (strcmp(j->path, path) != 0) { jp = &j->next; continue; }
+        *jp = j->next;
+        gb_free(j->snap);
+        us_save_drop(j->journal);
+        free(j);
+    }
+    while (E.save_active && strcmp(E.save_active->path, path) == 0)
+        pthread_cond_wait(&E.save_done, &E.save_mutex);
+    E.save_pending = E.save_queue || E.save_active;
+    pthread_mutex_unlock(&E.save_mutex);
+}
+
 void editor_init(void) {
     memset(&E, 0, sizeof E);
     pthread_mutex_init(&E.save_mutex, NULL);
+    pthread_cond_init(&E.save_cond, NULL);
+    pthread_cond_init(&E.save_done, NULL);
+    pthread_create(&E.save_thread, NULL, save_worker, NULL);
     E.panes[0] = pane_new();
     E.npanes   = 1;
     E.active   = 0;
@@ -634,12 +740,46 @@ void editor_cleanup(void) {
         ft_free(E.tree);
     }
     free(E.out_text);
+
+    /* Let the worker finish every queued save before exiting */
+    pthread_mutex_lock(&E.save_mutex);
+    E.save_quit = true;
+    pthread_cond_signal(&E.save_cond);
+    pthread_mutex_unlock(&E.save_mutex);
+    pthread_join(E.save_thread, NULL);
+    pthread_cond_destroy(&E.save_cond);
+    pthread_cond_destroy(&E.save_done);
     pthread_mutex_destroy(&E.save_mutex);
     unlink("./temp_bin");
 }
 
 /* ─── Main loop ──────────────────────────────────────────────── */
 
+/* Run the active pane's pending search for a few ms, jumping to the first
+   match as soon as there is one.  Keys are read in between, so a long
+   scan never holds up typing. */
+static void search_advance(Pane *ap) {
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (ap->hex_mode && ap->hex) {
+        HexPane *h = ap->hex;
+        bool had = h->search.current >= 0;
+        while (hex_search_step(h) && ms_since(&t0) < 20) ;
+        if (!had && h->search.current >= 0) {
+            h->cursor = h->search.matches[0];
+            h->nibble = 0;
+            hex_scroll_to_cursor(h, ap->win_h);
+        }
+        return;
+    }
+    bool had = ap->search.current >= 0;
+    while (search_step(&ap->search, ap->buf) && ms_since(&t0) < 20) ;
+    if (!had && ap->search.current >= 0) {
+        ap->cursor = ap->search.matches[0];
+        pane_move_cursor(ap, 0, 0);
+    }
+}
+
 void editor_run(const char *initial_file) {
     setlocale(LC_ALL, "");
     initscr(); raw(); noecho();
@@ -673,8 +813,27 @@ void editor_run(const char *initial_file) {
 
     while (E.running) {
         WINDOW *iw = E.panes[E.active]->win;
+        /* Wake up periodically while a file is still being indexed,
+           highlighted or checked against its undo journal, or a save is in
+           flight, to show progress and results */
+        pthread_mutex_lock(&E.save_mutex);
+        bool busy = E.save_pending || E.save_report;
+        pthread_mutex_unlock(&E.save_mutex);
+        for (int i = 0; i < E.npanes; i++)
+            if (E.panes[i]->li->bg || syn_busy(E.panes[i]->syn) ||
+                us_poll(E.panes[i]->undo)) busy = true;
+        Pane *sp = E.panes[E.active];
+        bool searching = sp->hex_mode && sp->hex ? sp->hex->search.pending
+                                                 : sp->search.pending;
+        wtimeout(iw ? iw : stdscr, searching ? 0 : busy ? 100 : -1);
         int key = wgetch(iw ? iw : stdscr);
 
+        if (key == ERR && searching) {
+            search_advance(E.panes[E.active]);
+            full_redraw(false);
+            continue;
+        }
+        if (key == ERR && busy) { full_redraw(false); continue; }
         if (key == 0 || key == ERR || key == 0x16) continue;
 
         if (key == KEY_RESIZE) {
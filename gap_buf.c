@@ -7,16 +7,26 @@ GapBuf *gb_new(size_t cap) {
     g->gap_start = 0;
     g->gap_end = cap;
     g->cap = cap;
+    g->pt = NULL;
+    return g;
+}
+
+/* Wrap a read-only mapping; the buffer takes ownership and unmaps it. */
+GapBuf *gb_new_mapped(const char *data, size_t len) {
+    GapBuf *g = calloc(1, sizeof *g);
+    g->pt = pt_new_mapped(data, len);
     return g;
 }
 
 void gb_free(GapBuf *g) {
     if (!g) return;
+    pt_free(g->pt);
     free(g->buf);
     free(g);
 }
 
 size_t gb_len(const GapBuf *g) {
+    if (g->pt) return g->pt->len;
     return g->cap - (g->gap_end - g->gap_start);
 }
 
@@ -25,12 +35,13 @@ static size_t gap_size(const GapBuf *g) {
 }
 
 char gb_at(const GapBuf *g, size_t i) {
+    if (g->pt) return pt_at(g->pt, i);
     if (i < g->gap_start) return g->buf[i];
     return g->buf[i + (g->gap_end - g->gap_start)];
 }
 
 void gb_move_gap(GapBuf *g, size_t pos) {
-    if (pos == g->gap_start) return;
+    if (g->pt || pos == g->gap_start) return;
     size_t gs = gap_size(g);
     if (pos < g->gap_start) {
         /* move text right */
@@ -63,12 +74,14 @@ static void gb_ensure_gap(GapBuf *g, size_t needed) {
 }
 
 void gb_insert_char(GapBuf *g, size_t pos, char c) {
+    if (g->pt) { pt_insert(g->pt, pos, &c, 1); return; }
     gb_ensure_gap(g, 1);
     gb_move_gap(g, pos);
     g->buf[g->gap_start++] = c;
 }
 
 void gb_insert_str(GapBuf *g, size_t pos, const char *s, size_t n) {
+    if (g->pt) { pt_insert(g->pt, pos, s, n); return; }
     gb_ensure_gap(g, n);
     gb_move_gap(g, pos);
     memcpy(g->buf + g->gap_start, s, n);
@@ -76,6 +89,7 @@ void gb_insert_str(GapBuf *g, size_t pos, const char *s, size_t n) {
 }
 
 void gb_delete(GapBuf *g, size_t pos, size_t n) {
+    if (g->pt) { pt_delete(g->pt, pos, n); return; }
     size_t len = gb_len(g);
     if (pos >= len) return;
     if (pos + n > len) n = len - pos;
@@ -86,27 +100,147 @@ void gb_delete(GapBuf *g, size_t pos, size_t n) {
 char *gb_to_str(const GapBuf *g) {
     size_t len = gb_len(g);
     char *s = malloc(len + 1);
-    if (g->gap_start > 0)
-        memcpy(s, g->buf, g->gap_start);
-    size_t post = g->cap - g->gap_end;
-    if (post > 0)
-        memcpy(s + g->gap_start, g->buf + g->gap_end, post);
+    gb_get_range(g, 0, len, s);
     s[len] = '\0';
     return s;
 }
 
 void gb_get_range(const GapBuf *g, size_t start, size_t len, char *out) {
-    for (size_t i = 0; i < len; i++)
-        out[i] = gb_at(g, start + i);
+    if (g->pt) { pt_get_range(g->pt, start, len, out); return; }
+    GbIter it; const char *p; size_t n;
+    gb_iter(&it, g, start, start + len);
+    while ((n = gb_iter_next(&it, &p))) { memcpy(out, p, n); out += n; }
+}
+
+/* Longest contiguous run starting at pos: *out points into the buffer
+   (or the mapping), the return value is its length, 0 at the end. */
+size_t gb_chunk(const GapBuf *g, size_t pos, const char **out) {
+    if (g->pt) return pt_chunk(g->pt, pos, out);
+    if (pos < g->gap_start) {
+        *out = g->buf + pos;
+        return g->gap_start - pos;
+    }
+    size_t i = pos + gap_size(g);
+    if (i >= g->cap) { *out = NULL; return 0; }
+    *out = g->buf + i;
+    return g->cap - i;
+}
+
+/* ─── Spans ──────────────────────────────────────────────────── */
+/* Walk [a, b) as contiguous runs:
+       GbIter it; const char *p; size_t n;
+       gb_iter(&it, g, a, b);
+       while ((n = gb_iter_next(&it, &p))) ... p[0..n) ...           */
+void gb_iter(GbIter *it, const GapBuf *g, size_t a, size_t b) {
+    size_t len = gb_len(g);
+    it->g   = g;
+    it->end = min_sz(b, len);
+    it->pos = min_sz(a, it->end);
+}
+
+size_t gb_iter_next(GbIter *it, const char **p) {
+    if (it->pos >= it->end) return 0;
+    size_t n = min_sz(gb_chunk(it->g, it->pos, p), it->end - it->pos);
+    it->pos += n;
+    return n;
+}
+
+/* g[pos, pos+len) as one block of memory: a pointer into the buffer when
+   the range sits in a single segment, else a copy in *scratch (grown as
+   needed; the caller owns it). */
+const char *gb_span(const GapBuf *g, size_t pos, size_t len,
+                    char **scratch, size_t *scap) {
+    const char *p;
+    if (!len) return "";
+    if (gb_chunk(g, pos, &p) >= len) return p;
+    if (*scap < len) {
+        *scap = len;
+        *scratch = realloc(*scratch, len);
+    }
+    gb_get_range(g, pos, len, *scratch);
+    return *scratch;
 }
 
-/* ─── Clone a gap buffer (for undo snapshots) ─────────────────── */
+/* ─── Clone a gap buffer (for save snapshots) ─────────────────── */
+/* Piece tables share the mapping, so only their edits are copied. */
 GapBuf *gb_clone(const GapBuf *g) {
     GapBuf *n = malloc(sizeof *n);
+    if (g->pt) {
+        *n = *g;
+        n->pt = pt_clone(g->pt);
+        return n;
+    }
+    n->pt  = NULL;
     n->cap = g->cap;
     n->gap_start = g->gap_start;
     n->gap_end   = g->gap_end;
     n->buf = malloc(g->cap);
-    memcpy(n->buf, g->buf, g->cap);
+    memcpy(n->buf, g->buf, g->gap_start);
+    memcpy(n->buf + g->gap_end, g->buf + g->gap_end, g->cap - g->gap_end);
     return n;
 }
+
+/* ─── Streaming write ────────────────────────────────────────── */
+#define GB_WRITE_IOV  64
+#define GB_CRLF_CHUNK 65536
+
+static bool write_iov(int fd, struct iovec *iov, int n) {
+    while (n > 0) {
+        ssize_t w = writev(fd, iov, n);
+        if (w < 0) { if (errno == EINTR) continue; return false; }
+        while (n > 0 && (size_t)w >= iov->iov_len) { w -= iov->iov_len; iov++; n--; }
+        if (n > 0) { iov->iov_base = (char *)iov->iov_base + w; iov->iov_len -= w; }
+    }
+    return true;
+}
+
+/* Write the whole buffer to fd straight from its segments, expanding
+   "\n" to "\r\n" through a bounded staging buffer when crlf is set.
+   Binary safe; returns false on a write error (errno is kept). */
+bool gb_write(const GapBuf *g, int fd, bool crlf) {
+    size_t len = gb_len(g);
+    struct iovec iov[GB_WRITE_IOV];
+    int n = 0;
+    if (!crlf) {
+        for (size_t pos = 0; pos < len; ) {
+            const char *c;
+            size_t k = gb_chunk(g, pos, &c);
+            iov[n++] = (struct iovec){ (void *)c, k };
+            pos += k;
+            if (n == GB_WRITE_IOV) {
+                if (!write_iov(fd, iov, n)) return false;
+                n = 0;
+            }
+        }
+        return write_iov(fd, iov, n);
+    }
+
+    char *out = malloc(GB_CRLF_CHUNK);
+    size_t o = 0;
+    bool ok = true;
+    for (size_t pos = 0; pos < len && ok; ) {
+        const char *c;
+        size_t k = gb_chunk(g, pos, &c);
+        pos += k;
+        while (k > 0 && ok) {
+            /* Worst case every byte is a newline: half a chunk of input */
+            size_t take = min_sz(k, (GB_CRLF_CHUNK - o) / 2);
+            for (size_t i = 0; i < take; i++) {
+                if (c[i] == '\n') out[o++] = '\r';
+                out[o++] = c[i];
+            }
+            c += take; k -= take;
+            if (o >= GB_CRLF_CHUNK / 2) {
+                iov[0] = (struct iovec){ out, o };
+                ok = write_iov(fd, iov, 1);
+                o = 0;
+            }
+        }
+    }
+    if (ok && o) {
+        iov[0] = (struct iovec){ out, o };
+        ok = write_iov(fd, iov, 1);
+    }
+    free(out);
+    return ok;
+}
@@ -22,19 +22,22 @@ HexPane *hex_new(void) {
     HexPane *h = calloc(1, sizeof *h);
     h->data_cap = 4096;
     h->data     = malloc(h->data_cap);
+    h->search.current = -1;
     return h;
 }
 
 void hex_free(HexPane *h) {
     if (!h) return;
+    search_clear(&h->search);
+    free(h->search.matches);
     free(h->data);
-    free(h->search_results);
     free(h);
 }
 
 bool hex_load(HexPane *h, const char *path) {
     int fd = open(path, O_RDONLY);
     if (fd < 0) return false;
+    search_clear(&h->search);
     struct stat st; fstat(fd, &st);
     size_t sz = (size_t)st.st_size;
     if (sz > h->data_cap) {
@@ -68,24 +71,18 @@ bool hex_save(HexPane *h, const char *path) {
     return true;
 }
 
+/* Every occurrence of query, overlapping ones included.  The scan runs
+   in steps (hex_search_step) with the text search kernels and workers. */
 void hex_search_ascii(HexPane *h, const char *query) {
-    free(h->search_results); h->search_results = NULL;
-    h->search_count = 0; h->search_current = 0;
-    if (!query || !query[0]) return;
-    size_t qlen = strlen(query);
-    if (qlen > h->data_len) return;
-    size_t cap = 64;
-    h->search_results = malloc(cap * sizeof(size_t));
-    for (size_t i = 0; i <= h->data_len - qlen; i++) {
-        if (memcmp(h->data + i, query, qlen) == 0) {
-            if (h->search_count >= cap) {
-                cap *= 2;
-                h->search_results = realloc(h->search_results, cap * sizeof(size_t));
-            }
-            h->search_results[h->search_count++] = i;
-        }
-    }
-    strncpy(h->search_query, query, sizeof(h->search_query)-1);
+    search_clear(&h->search);
+    h->search.overlap = true;
+    h->view = (GapBuf){ .buf = (char *)h->data, .gap_start = h->data_len,
+                        .gap_end = h->data_len, .cap = h->data_len };
+    search_start(&h->search, query ? query : "");
+}
+
+bool hex_search_step(HexPane *h) {
+    return search_step(&h->search, &h->view);
 }
 
 /* ------------------------------------------------------------------ */
@@ -114,9 +111,10 @@ void hex_render(HexPane *h, WINDOW *win, int win_h, int win_w) {
         wprintw(win, "%02X ", b);
     }
     waddstr(win, " ASCII           ");
-    if (h->search_count > 0)
-        wprintw(win, "[%zu/%zu] \"%s\"",
-                h->search_current + 1, h->search_count, h->search_query);
+    if (h->search.query[0])
+        wprintw(win, "[%d/%zu%s] \"%s\"",
+                h->search.current + 1, h->search.count,
+                h->search.pending ? "+" : "", h->search.query);
     wclrtoeol(win);
     wattroff(win, COLOR_PAIR(HEX_CP_HEADER) | A_BOLD);
 
@@ -124,7 +122,8 @@ void hex_render(HexPane *h, WINDOW *win, int win_h, int win_w) {
                       ? (h->data_len + HEX_BYTES_PER_ROW - 1) / HEX_BYTES_PER_ROW : 1;
     size_t cur_row = h->cursor / HEX_BYTES_PER_ROW;
     size_t cur_col = h->cursor % HEX_BYTES_PER_ROW;
-    size_t qlen    = h->search_query[0] ? strlen(h->search_query) : 0;
+    size_t qlen    = strlen(h->search.query);
+    size_t hit     = h->search.current >= 0 ? h->search.matches[h->search.current] : 0;
 
     for (int row = 0; row < text_rows; row++) {
         size_t vrow = h->scroll_row + (size_t)row;
@@ -146,9 +145,8 @@ void hex_render(HexPane *h, WINDOW *win, int win_h, int win_w) {
             size_t  ap2    = rs + b;
             uint8_t byte   = h->data[ap2];
             bool    is_cur = (vrow == cur_row && b == cur_col);
-            bool    is_srch = qlen > 0 && h->search_count > 0 &&
-                              ap2 >= h->search_results[h->search_current] &&
-                              ap2 <  h->search_results[h->search_current] + qlen;
+            bool    is_srch = h->search.current >= 0 &&
+                              ap2 >= hit && ap2 < hit + qlen;
 
             if      (is_cur && h->focus == HEX_FOCUS_HEX)   wattron(win, COLOR_PAIR(HEX_CP_CURSOR_H)|A_BOLD);
             else if (is_cur && h->focus == HEX_FOCUS_ASCII)  wattron(win, COLOR_PAIR(HEX_CP_PEER));
@@ -173,9 +171,8 @@ void hex_render(HexPane *h, WINDOW *win, int win_h, int win_w) {
             size_t  ap2    = rs + b;
             uint8_t byte   = h->data[ap2];
             bool    is_cur = (vrow == cur_row && b == cur_col);
-            bool    is_srch = qlen > 0 && h->search_count > 0 &&
-                              ap2 >= h->search_results[h->search_current] &&
-                              ap2 <  h->search_results[h->search_current] + qlen;
+            bool    is_srch = h->search.current >= 0 &&
+                              ap2 >= hit && ap2 < hit + qlen;
             char disp = isprint(byte) ? (char)byte : '.';
 
             if      (is_cur && h->focus == HEX_FOCUS_ASCII) wattron(win, COLOR_PAIR(HEX_CP_CURSOR_A)|A_BOLD);
@@ -224,16 +221,16 @@ bool hex_handle_key(HexPane *h, int key, int win_h) {
 
         /* Ctrl+N / Ctrl+P — résultat suivant / précédent */
         case 'n'&0x1f:
-            if (h->search_count > 0) {
-                h->search_current = (h->search_current + 1) % h->search_count;
-                h->cursor = h->search_results[h->search_current];
+            if (h->search.count > 0) {
+                h->search.current = (h->search.current + 1) % (int)h->search.count;
+                h->cursor = h->search.matches[h->search.current];
                 hex_scroll_to_cursor(h, win_h);
             }
             return true;
         case 'p'&0x1f:
-            if (h->search_count > 0) {
-                h->search_current = (h->search_current + h->search_count - 1) % h->search_count;
-                h->cursor = h->search_results[h->search_current];
+            if (h->search.count > 0) {
+                h->search.current = (h->search.current - 1 + (int)h->search.count) % (int)h->search.count;
+                h->cursor = h->search.matches[h->search.current];
                 hex_scroll_to_cursor(h, win_h);
             }
             return true;
@@ -241,6 +238,7 @@ bool hex_handle_key(HexPane *h, int key, int win_h) {
         default:
             /* ASCII panel */
             if (h->focus == HEX_FOCUS_ASCII && h->data_len > 0 && key >= 32 && key < 127) {
+                search_cancel(&h->search);   /* les workers lisent data */
                 h->data[h->cursor] = (uint8_t)key; h->modified = true;
                 if (h->cursor + 1 < h->data_len) h->cursor++;
                 hex_scroll_to_cursor(h, win_h); return true;
@@ -252,6 +250,7 @@ bool hex_handle_key(HexPane *h, int key, int win_h) {
                 else if (key >= 'a' && key <= 'f') nv = key - 'a' + 10;
                 else if (key >= 'A' && key <= 'F') nv = key - 'A' + 10;
                 if (nv >= 0) {
+                    search_cancel(&h->search);
                     uint8_t b = h->data[h->cursor];
                     if (h->nibble == 0) {
                         h->data[h->cursor] = (uint8_t)((nv << 4) | (b & 0x0F));
@@ -1,50 +1,584 @@
 #include "abyss.h"
 
+/* Line starts are kept in blocks of at most LINE_IDX_CHUNK lines, each
+   relative to the block's first byte.  Two Fenwick trees over the blocks
+   hold per-block line and byte counts, so locating a line or an offset is
+   O(log n) and an edit only rewrites the blocks it touches. */
+
+/* ─── Newline scanning ───────────────────────────────────────── */
+
+/* Kernels write base+i+1 (the start of the next line) for every '\n' at
+   p[i], i < n, into out[] and return how many they found. */
+typedef size_t (*NlScanFn)(const char *p, size_t n, size_t base, size_t *out);
+
+#define NL_SLICE 4096   /* bytes scanned per kernel call */
+
+static size_t nl_scan_scalar(const char *p, size_t n, size_t base, size_t *out) {
+    size_t k = 0;
+    for (size_t i = 0; i < n; i++)
+        if (p[i] == '\n') out[k++] = base + i + 1;
+    return k;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+__attribute__((target("sse2")))
+static size_t nl_scan_sse2(const char *p, size_t n, size_t base, size_t *out) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    size_t i = 0, k = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        unsigned m = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        while (m) { out[k++] = base + i + __builtin_ctz(m) + 1; m &= m - 1; }
+    }
+    return k + nl_scan_scalar(p + i, n - i, base + i, out + k);
+}
+
+__attribute__((target("avx2")))
+static size_t nl_scan_avx2(const char *p, size_t n, size_t base, size_t *out) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    size_t i = 0, k = 0;
+    for (; i + 64 <= n; i += 64) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(p + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(p + i + 32));
+        uint64_t m = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, nl))
+                   | (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(b, nl)) << 32;
+        while (m) { out[k++] = base + i + __builtin_ctzll(m) + 1; m &= m - 1; }
+    }
+    return k + nl_scan_sse2(p + i, n - i, base + i, out + k);
+}
+#endif
+
+static const struct { const char *name; NlScanFn fn; } nl_kernels[] = {
+#if defined(__x86_64__) || defined(__i386__)
+    { "avx2",   nl_scan_avx2   },
+    { "sse2",   nl_scan_sse2   },
+#endif
+    { "scalar", nl_scan_scalar },
+};
+
+static NlScanFn nl_scan;
+
+static bool nl_kernel_ok(const char *name) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (!strcmp(name, "avx2")) return __builtin_cpu_supports("avx2");
+    if (!strcmp(name, "sse2")) return __builtin_cpu_supports("sse2");
+#endif
+    return true;
+}
+
+/* Select the newline kernel by name, or the best one the CPU supports
+   when name is NULL.  Returns the name of the kernel in use. */
+const char *li_set_scan(const char *name) {
+    size_t n = sizeof nl_kernels / sizeof nl_kernels[0];
+    for (size_t i = 0; i < n; i++) {
+        if (name && strcmp(name, nl_kernels[i].name)) continue;
+        if (!nl_kernel_ok(nl_kernels[i].name)) continue;
+        nl_scan = nl_kernels[i].fn;
+        return nl_kernels[i].name;
+    }
+    return name ? li_set_scan(NULL) : NULL;
+}
+
+/* Hand every line start in g[pos, pos+len) to emit() in batches,
+   scanning the buffer's contiguous chunks directly. */
+typedef void (*NlEmitFn)(void *ctx, const size_t *starts, size_t n);
+
+static void nl_scan_range(const GapBuf *g, size_t pos, size_t len,
+                          NlEmitFn emit, void *ctx) {
+    if (!nl_scan) li_set_scan(NULL);
+    size_t starts[NL_SLICE];
+    size_t end = pos + len;
+    while (pos < end) {
+        const char *p;
+        size_t n = min_sz(gb_chunk(g, pos, &p), end - pos);
+        if (!n) break;
+        for (size_t o = 0; o < n; o += NL_SLICE) {
+            size_t k = nl_scan(p + o, min_sz(NL_SLICE, n - o), pos + o, starts);
+            if (k) emit(ctx, starts, k);
+        }
+        pos += n;
+    }
+}
+
+/* ─── Fenwick helpers (1-based trees, 0-based block indices) ──── */
+
+static void fw_add(size_t *fw, size_t n, size_t i, size_t d) {
+    for (i++; i <= n; i += i & -i) fw[i] += d;
+}
+
+static size_t fw_prefix(const size_t *fw, size_t i) {
+    size_t s = 0;
+    for (; i > 0; i -= i & -i) s += fw[i];
+    return s;
+}
+
+/* Last block whose prefix sum is <= target; *before gets that prefix. */
+static size_t fw_find(const size_t *fw, size_t n, size_t target, size_t *before) {
+    size_t idx = 0, sum = 0, step = 1;
+    while (step * 2 <= n) step *= 2;
+    for (; step; step /= 2) {
+        if (idx + step <= n && sum + fw[idx + step] <= target) {
+            idx += step;
+            sum += fw[idx];
+        }
+    }
+    if (idx >= n) {            /* target at/after the end: last block */
+        idx = n - 1;
+        sum -= fw_prefix(fw, n) - fw_prefix(fw, idx);
+    }
+    *before = sum;
+    return idx;
+}
+
+static void fw_build(LineIdx *li) {
+    size_t n = li->nblocks;
+    for (size_t i = 1; i <= n; i++) {
+        li->fw_lines[i] = li->blocks[i-1].count;
+        li->fw_bytes[i] = li->blocks[i-1].bytes;
+    }
+    for (size_t i = 1; i <= n; i++) {
+        size_t j = i + (i & -i);
+        if (j <= n) {
+            li->fw_lines[j] += li->fw_lines[i];
+            li->fw_bytes[j] += li->fw_bytes[i];
+        }
+    }
+}
+
+static void li_reserve(LineIdx *li, size_t nblocks) {
+    if (nblocks <= li->bcap) return;
+    while (li->bcap < nblocks) li->bcap *= 2;
+    li->blocks   = realloc(li->blocks,   li->bcap * sizeof(LineBlock));
+    li->fw_lines = realloc(li->fw_lines, (li->bcap + 1) * sizeof(size_t));
+    li->fw_bytes = realloc(li->fw_bytes, (li->bcap + 1) * sizeof(size_t));
+}
+
+static size_t blk_line_len(const LineBlock *b, size_t i) {
+    return (i + 1 < b->count ? b->starts[i+1] : b->bytes) - b->starts[i];
+}
+
+/* ─── Lifecycle ──────────────────────────────────────────────── */
+
+static void li_reset(LineIdx *li) {
+    for (size_t i = 1; i < li->nblocks; i++) free(li->blocks[i].starts);
+    li->nblocks = 1;
+    li->blocks[0].starts[0] = 0;
+    li->blocks[0].count = 1;
+    li->blocks[0].bytes = 0;
+    li->count = 1;
+}
+
 LineIdx *li_new(void) {
     LineIdx *li = calloc(1, sizeof *li);
-    li->cap = LINE_IDX_CHUNK;
-    li->offsets = malloc(li->cap * sizeof(size_t));
-    li->offsets[0] = 0;
-    li->count = 1;
+    li->bcap = 16;
+    li->blocks   = malloc(li->bcap * sizeof(LineBlock));
+    li->fw_lines = calloc(li->bcap + 1, sizeof(size_t));
+    li->fw_bytes = calloc(li->bcap + 1, sizeof(size_t));
+    li->blocks[0].starts = malloc(LINE_IDX_CHUNK * sizeof(size_t));
+    li->nblocks = 1;
+    li_reset(li);
+    fw_build(li);
     li->dirty = true;
     return li;
 }
 
 void li_free(LineIdx *li) {
     if (!li) return;
-    free(li->offsets);
+    li_cancel(li);
+    for (size_t i = 0; i < li->nblocks; i++) free(li->blocks[i].starts);
+    free(li->blocks);
+    free(li->fw_lines);
+    free(li->fw_bytes);
     free(li);
 }
 
+typedef struct { LineIdx *li; size_t base; } RebuildCtx;
+
+static void rebuild_emit(void *ctx, const size_t *starts, size_t n) {
+    RebuildCtx *rc = ctx;
+    LineIdx *li = rc->li;
+    LineBlock *b = &li->blocks[li->nblocks - 1];
+    for (size_t i = 0; i < n; i++) {
+        if (b->count == LINE_IDX_CHUNK) {
+            li_reserve(li, li->nblocks + 1);
+            b = &li->blocks[li->nblocks - 1];
+            b->bytes = starts[i] - rc->base;
+            rc->base = starts[i];
+            b = &li->blocks[li->nblocks++];
+            b->starts = malloc(LINE_IDX_CHUNK * sizeof(size_t));
+            b->count  = 0;
+        }
+        b->starts[b->count++] = starts[i] - rc->base;
+    }
+    li->count += n;
+}
+
 void li_rebuild(LineIdx *li, const GapBuf *g) {
-    li->count = 0;
+    li_cancel(li);
+    li_reset(li);
     size_t len = gb_len(g);
+    RebuildCtx rc = { li, 0 };        /* base: absolute start of last block */
+    nl_scan_range(g, 0, len, rebuild_emit, &rc);
+    li->blocks[li->nblocks - 1].bytes = len - rc.base;
+    fw_build(li);
+    li->dirty = false;
+}
 
-    /* ensure capacity */
-    if (li->cap < 2) {
-        li->cap = LINE_IDX_CHUNK;
-        li->offsets = realloc(li->offsets, li->cap * sizeof(size_t));
+void li_mark_dirty(LineIdx *li) { li->dirty = true; }
+
+size_t li_line_count(const LineIdx *li) { return li->count; }
+
+size_t li_line_start(const LineIdx *li, size_t line) {
+    if (line >= li->count) return 0;
+    size_t before;
+    size_t b = fw_find(li->fw_lines, li->nblocks, line, &before);
+    return fw_prefix(li->fw_bytes, b) + li->blocks[b].starts[line - before];
+}
+
+size_t li_line_of(const LineIdx *li, size_t pos) {
+    size_t base;
+    size_t b = fw_find(li->fw_bytes, li->nblocks, pos, &base);
+    const LineBlock *blk = &li->blocks[b];
+    size_t lo = 0, hi = blk->count;
+    while (lo + 1 < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (blk->starts[mid] <= pos - base) lo = mid; else hi = mid;
+    }
+    return fw_prefix(li->fw_lines, b) + lo;
+}
+
+/* Offset of the '\n' ending line, or of the end of the indexed text. */
+size_t li_line_end(const LineIdx *li, size_t line, const GapBuf *g) {
+    if (line + 1 < li->count) return li_line_start(li, line + 1) - 1;
+    if (!li->bg) return gb_len(g);
+    size_t end = fw_prefix(li->fw_bytes, li->nblocks);
+    return end ? end - 1 : 0;
+}
+
+/* ─── Incremental update ─────────────────────────────────────── */
+
+/* Replace lines [first, last] by nl lines of the given lengths, rewriting
+   only the blocks that hold them (plus a neighbour if they get tiny). */
+static void li_replace(LineIdx *li, size_t first, size_t last,
+                       const size_t *lens, size_t nl) {
+    size_t lb_before, mb_before;
+    size_t bl = fw_find(li->fw_lines, li->nblocks, first, &lb_before);
+    size_t bm = fw_find(li->fw_lines, li->nblocks, last,  &mb_before);
+    size_t span = mb_before + li->blocks[bm].count - lb_before;
+    size_t head = first - lb_before;
+    size_t tail = span - (last - lb_before + 1);
+    if (head + nl + tail < LINE_IDX_CHUNK / 4 && bm + 1 < li->nblocks) {
+        bm++;
+        span += li->blocks[bm].count;
+        tail += li->blocks[bm].count;
+    }
+
+    /* Gather the line lengths of the affected blocks, with the range swapped */
+    size_t n = head + nl + tail;
+    size_t *all = malloc((span + nl) * sizeof(size_t));
+    size_t k = 0;
+    for (size_t b = bl; b <= bm; b++)
+        for (size_t i = 0; i < li->blocks[b].count; i++)
+            all[k++] = blk_line_len(&li->blocks[b], i);
+    memmove(all + head + nl, all + span - tail, tail * sizeof(size_t));
+    memcpy(all + head, lens, nl * sizeof(size_t));
+
+    /* Redistribute, leaving half a chunk of room when splitting */
+    size_t old_nb = bm - bl + 1;
+    size_t new_nb = n <= LINE_IDX_CHUNK ? 1
+                  : (n + LINE_IDX_CHUNK/2 - 1) / (LINE_IDX_CHUNK/2);
+    size_t per = (n + new_nb - 1) / new_nb;
+
+    LineBlock *nb = malloc(new_nb * sizeof(LineBlock));
+    for (size_t i = 0; i < new_nb; i++)
+        nb[i].starts = i < old_nb ? li->blocks[bl + i].starts
+                                  : malloc(LINE_IDX_CHUNK * sizeof(size_t));
+    for (size_t i = new_nb; i < old_nb; i++) free(li->blocks[bl + i].starts);
+
+    k = 0;
+    for (size_t i = 0; i < new_nb; i++) {
+        size_t cnt = min_sz(per, n - k), off = 0;
+        for (size_t j = 0; j < cnt; j++) {
+            nb[i].starts[j] = off;
+            off += all[k++];
+        }
+        nb[i].count = cnt;
+        nb[i].bytes = off;
     }
+    free(all);
 
-    li->offsets[li->count++] = 0;
+    if (new_nb == old_nb) {
+        for (size_t i = 0; i < new_nb; i++) {
+            LineBlock *ob = &li->blocks[bl + i];
+            fw_add(li->fw_lines, li->nblocks, bl + i, nb[i].count - ob->count);
+            fw_add(li->fw_bytes, li->nblocks, bl + i, nb[i].bytes - ob->bytes);
+            *ob = nb[i];
+        }
+    } else {
+        li_reserve(li, li->nblocks - old_nb + new_nb);
+        memmove(li->blocks + bl + new_nb, li->blocks + bm + 1,
+                (li->nblocks - bm - 1) * sizeof(LineBlock));
+        memcpy(li->blocks + bl, nb, new_nb * sizeof(LineBlock));
+        li->nblocks = li->nblocks - old_nb + new_nb;
+        fw_build(li);
+    }
+    free(nb);
+    li->count = li->count - (last - first + 1) + nl;
+}
 
-    for (size_t i = 0; i < len; i++) {
-        if (gb_at(g, i) == '\n') {
-            if (li->count >= li->cap) {
-                li->cap *= 2;
-                li->offsets = realloc(li->offsets, li->cap * sizeof(size_t));
+typedef struct { size_t *lens; size_t n, cap; size_t prev; } EditCtx;
+
+static void edit_emit(void *ctx, const size_t *starts, size_t n) {
+    EditCtx *ec = ctx;
+    if (ec->n + n > ec->cap) {
+        while (ec->n + n > ec->cap) ec->cap *= 2;
+        ec->lens = realloc(ec->lens, ec->cap * sizeof(size_t));
+    }
+    for (size_t i = 0; i < n; i++) {
+        ec->lens[ec->n++] = starts[i] - ec->prev;
+        ec->prev = starts[i];
+    }
+}
+
+/* Update the index after [pos, pos+removed) was replaced by `inserted`
+   bytes, which are already in g.  Cost: O(log n + chunk + inserted). */
+void li_edit(LineIdx *li, const GapBuf *g, size_t pos,
+             size_t removed, size_t inserted) {
+    if (li->dirty) { li_rebuild(li, g); return; }
+    if (!removed && !inserted) return;
+    if (li->bg) li_wait(li);   /* the worker indexes the pre-edit text */
+
+    size_t end   = pos + removed;
+    size_t first = li_line_of(li, pos);
+    size_t last  = li_line_of(li, end);
+    size_t s0    = li_line_start(li, first);
+    size_t e1    = last + 1 < li->count ? li_line_start(li, last + 1)
+                                        : fw_prefix(li->fw_bytes, li->nblocks);
+
+    EditCtx ec = { malloc(16 * sizeof(size_t)), 0, 16, s0 };
+    nl_scan_range(g, pos, inserted, edit_emit, &ec);
+    /* Last new line: rest of the insertion plus the tail of `last` */
+    if (ec.n + 1 > ec.cap) ec.lens = realloc(ec.lens, (ec.n + 1) * sizeof(size_t));
+    ec.lens[ec.n++] = (pos + inserted - ec.prev) + (e1 - end);
+
+    li_replace(li, first, last, ec.lens, ec.n);
+    free(ec.lens);
+}
+
+/* ─── Background build ───────────────────────────────────────── */
+/* A huge mapped file is indexed by a worker thread.  The first
+   LI_BG_HEAD bytes are scanned up front so the first screen is ready at
+   once; after every LI_BG_SLICE the worker hands over the blocks it has
+   closed plus a copy of the one it is filling, and li_poll() splices
+   them in.  Until the worker is done the index ends at the last complete
+   line seen so far.  An edit waits for the worker, since it indexes the
+   text as it was when the file was opened. */
+
+#define LI_BG_HEAD  (256 * 1024)
+#define LI_BG_SLICE (4 * 1024 * 1024)
+
+typedef struct LiBuild {
+    const char     *data;
+    size_t          len;
+    pthread_t       thread;
+    bool            running;       /* thread started and not yet joined */
+    pthread_mutex_t lock;
+    bool            cancel;
+    /* Shared under lock */
+    LineBlock      *ready;         /* closed blocks not yet adopted */
+    size_t          nready, rcap;
+    size_t         *peek;          /* line starts of the open block */
+    size_t          npeek;
+    size_t          scanned;
+    bool            done;
+    /* Owned by li: starts of the provisional last block */
+    size_t         *tail;
+    bool            has_tail;
+    /* Owned by the scanner */
+    LineBlock       open;
+    size_t          base;          /* absolute start of the open block */
+    LineBlock      *closed;
+    size_t          nclosed, ccap;
+} LiBuild;
+
+static void bg_emit(void *ctx, const size_t *starts, size_t n) {
+    LiBuild *b = ctx;
+    for (size_t i = 0; i < n; i++) {
+        if (b->open.count == LINE_IDX_CHUNK) {
+            b->open.bytes = starts[i] - b->base;
+            if (b->nclosed == b->ccap) {
+                b->ccap = b->ccap ? b->ccap * 2 : 16;
+                b->closed = realloc(b->closed, b->ccap * sizeof(LineBlock));
             }
-            li->offsets[li->count++] = i + 1;
+            b->closed[b->nclosed++] = b->open;
+            b->open.starts = malloc(LINE_IDX_CHUNK * sizeof(size_t));
+            b->open.count  = 0;
+            b->base = starts[i];
         }
+        b->open.starts[b->open.count++] = starts[i] - b->base;
     }
-    li->dirty = false;
 }
 
-void li_mark_dirty(LineIdx *li) { li->dirty = true; }
+static void bg_scan(LiBuild *b, size_t from, size_t to) {
+    size_t starts[NL_SLICE];
+    for (size_t o = from; o < to; o += NL_SLICE) {
+        size_t k = nl_scan(b->data + o, min_sz(NL_SLICE, to - o), o, starts);
+        if (k) bg_emit(b, starts, k);
+    }
+}
 
-size_t li_line_count(const LineIdx *li) { return li->count; }
+/* Hand the scanner's progress over to the shared side. */
+static void bg_publish(LiBuild *b, size_t scanned) {
+    pthread_mutex_lock(&b->lock);
+    if (b->nready + b->nclosed + 1 > b->rcap) {
+        while (b->nready + b->nclosed + 1 > b->rcap) b->rcap *= 2;
+        b->ready = realloc(b->ready, b->rcap * sizeof(LineBlock));
+    }
+    memcpy(b->ready + b->nready, b->closed, b->nclosed * sizeof(LineBlock));
+    b->nready += b->nclosed;
+    b->nclosed = 0;
+    if (scanned == b->len) {
+        b->open.bytes = b->len - b->base;
+        b->ready[b->nready++] = b->open;
+        b->open.starts = NULL;
+        b->done = true;
+    } else {
+        memcpy(b->peek, b->open.starts, b->open.count * sizeof(size_t));
+        b->npeek = b->open.count;
+    }
+    __atomic_store_n(&b->scanned, scanned, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&b->lock);
+}
 
-size_t li_line_start(const LineIdx *li, size_t line) {
-    if (line >= li->count) return 0;
-    return li->offsets[line];
+static void *bg_thread(void *arg) {
+    LiBuild *b = arg;
+    size_t pos = b->scanned;
+    while (pos < b->len && !__atomic_load_n(&b->cancel, __ATOMIC_RELAXED)) {
+        size_t end = min_sz(pos + LI_BG_SLICE, b->len);
+        bg_scan(b, pos, end);
+        bg_publish(b, end);
+        pos = end;
+    }
+    return NULL;
+}
+
+static void bg_drop_tail(LineIdx *li) {
+    if (li->bg->has_tail) { li->nblocks--; li->bg->has_tail = false; }
+}
+
+/* Index data[0..len), the text of a freshly opened mapped buffer, mostly
+   in the background.  data must stay mapped until li_wait/li_cancel. */
+void li_build_async(LineIdx *li, const char *data, size_t len) {
+    li_cancel(li);
+    if (!nl_scan) li_set_scan(NULL);
+    LiBuild *b = calloc(1, sizeof *b);
+    b->data = data;
+    b->len  = len;
+    pthread_mutex_init(&b->lock, NULL);
+    b->rcap  = 16;
+    b->ready = malloc(b->rcap * sizeof(LineBlock));
+    b->peek  = malloc(LINE_IDX_CHUNK * sizeof(size_t));
+    b->tail  = malloc(LINE_IDX_CHUNK * sizeof(size_t));
+    b->open.starts = malloc(LINE_IDX_CHUNK * sizeof(size_t));
+    b->open.starts[0] = 0;
+    b->open.count = 1;
+
+    /* Adopted blocks replace everything */
+    for (size_t i = 0; i < li->nblocks; i++) free(li->blocks[i].starts);
+    li->nblocks = 0;
+    li->count   = 0;
+    li->dirty   = false;
+    li->bg      = b;
+
+    size_t head = min_sz(len, LI_BG_HEAD);
+    bg_scan(b, 0, head);
+    bg_publish(b, head);
+    li_poll(li);
+    if (li->bg) b->running = pthread_create(&b->thread, NULL, bg_thread, b) == 0;
+    if (li->bg && !b->running) li_wait(li);
+}
+
+/* Splice in whatever the worker has finished; call once per frame. */
+void li_poll(LineIdx *li) {
+    LiBuild *b = li->bg;
+    if (!b) return;
+    bg_drop_tail(li);
+    pthread_mutex_lock(&b->lock);
+    li_reserve(li, li->nblocks + b->nready + 1);
+    memcpy(li->blocks + li->nblocks, b->ready, b->nready * sizeof(LineBlock));
+    li->nblocks += b->nready;
+    b->nready = 0;
+    bool done = b->done;
+    if (!done && (b->npeek > 1 || li->nblocks == 0)) {
+        /* Provisional block: the open one minus its unfinished line */
+        size_t n = b->npeek > 1 ? b->npeek - 1 : 1;
+        memcpy(b->tail, b->peek, n * sizeof(size_t));
+        li->blocks[li->nblocks++] = (LineBlock){ b->tail, n,
+                                                 b->npeek > 1 ? b->peek[n] : 0 };
+        b->has_tail = true;
+    }
+    pthread_mutex_unlock(&b->lock);
+    fw_build(li);
+    li->count = fw_prefix(li->fw_lines, li->nblocks);
+
+    if (done) {
+        if (b->running) pthread_join(b->thread, NULL);
+        pthread_mutex_destroy(&b->lock);
+        free(b->ready); free(b->peek); free(b->tail); free(b->closed);
+        free(b);
+        li->bg = NULL;
+    }
+}
+
+/* Finish indexing in the foreground. */
+void li_wait(LineIdx *li) {
+    LiBuild *b = li->bg;
+    if (!b) return;
+    if (b->running) {
+        pthread_join(b->thread, NULL);
+        b->running = false;
+    } else {
+        bg_thread(b);
+    }
+    li_poll(li);
+}
+
+/* Stop the worker and leave an empty index (to be rebuilt). */
+void li_cancel(LineIdx *li) {
+    LiBuild *b = li->bg;
+    if (!b) return;
+    __atomic_store_n(&b->cancel, true, __ATOMIC_RELAXED);
+    if (b->running) pthread_join(b->thread, NULL);
+    bg_drop_tail(li);
+    for (size_t i = 0; i < b->nready;  i++) free(b->ready[i].starts);
+    for (size_t i = 0; i < b->nclosed; i++) free(b->closed[i].starts);
+    free(b->open.starts);
+    pthread_mutex_destroy(&b->lock);
+    free(b->ready); free(b->peek); free(b->tail); free(b->closed);
+    free(b);
+    li->bg = NULL;
+    /* Keep the li_reset invariant: block 0 exists and owns its starts */
+    if (li->nblocks == 0) {
+        li->blocks[0].starts = malloc(LINE_IDX_CHUNK * sizeof(size_t));
+        li->nblocks = 1;
+    }
+    li_reset(li);
+    fw_build(li);
+    li->dirty = true;
+}
+
+/* Whether pos lies within the lines indexed so far. */
+bool li_covers(const LineIdx *li, size_t pos) {
+    return !li->bg || pos < fw_prefix(li->fw_bytes, li->nblocks);
+}
+
+/* Percentage of the text indexed so far. */
+int li_progress(const LineIdx *li) {
+    if (!li->bg) return 100;
+    size_t len = li->bg->len;
+    size_t done = __atomic_load_n(&li->bg->scanned, __ATOMIC_RELAXED);
+    return len ? (int)(done * 100 / len) : 100;
 }
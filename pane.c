@@ -2,19 +2,20 @@
 #include "utf8.h"
 #include <string.h>
 
-GapBuf *gb_clone(const GapBuf *g);
-
 /* ── UTF-8 helpers on GapBuf ──────────────────────────────────────── */
 
-/* Read up to 4 bytes from GapBuf at byte offset pos into tmp[], decode. */
+/* Decode the codepoint at byte offset pos, in place unless it straddles
+   a segment boundary. */
 static int gb_decode_cp(const GapBuf *g, size_t pos, uint32_t *cp) {
     size_t len = gb_len(g);
     if (pos >= len) { *cp = 0; return 0; }
-    char tmp[4];
-    int n = utf8_byte_len((unsigned char)gb_at(g, pos));
+    const char *s;
+    size_t avail = gb_chunk(g, pos, &s);
+    int n = utf8_byte_len((unsigned char)s[0]);
     if ((size_t)n > len - pos) n = (int)(len - pos);
-    for (int i = 0; i < n; i++) tmp[i] = gb_at(g, pos + i);
-    return utf8_decode(tmp, (size_t)n, cp);
+    char tmp[4];
+    if ((size_t)n > avail) { gb_get_range(g, pos, (size_t)n, tmp); s = tmp; }
+    return utf8_decode(s, (size_t)n, cp);
 }
 
 /* Visual width of the character at byte offset pos in GapBuf. */
@@ -92,9 +93,10 @@ Pane *pane_new(void) {
 
 void pane_free(Pane *p) {
     if (!p) return;
-    gb_free(p->buf);
-    li_free(p->li);
+    search_clear(&p->search);
     syn_free(p->syn);
+    li_free(p->li);
+    gb_free(p->buf);
     us_free(p->undo);
     free(p->clip.text);
     free(p->search.matches);
@@ -115,7 +117,11 @@ void pane_open_file(Pane *p, const char *path) {
         strncpy(p->filename, path, sizeof(p->filename)-1);
     p->filename[sizeof(p->filename)-1] = '\0';
 
-    /* Vider le buffer précédent avant de charger */
+    /* Vider le buffer précédent avant de charger (le surligneur d'abord,
+       il lit le buffer depuis son thread) */
+    syn_free(p->syn); p->syn = syn_new(LANG_NONE);
+    li_free(p->li);   p->li  = li_new();
+    search_clear(&p->search);
     gb_free(p->buf); p->buf = gb_new(GAP_DEFAULT);
     p->cursor = 0; p->cursor_line = 0; p->cursor_col = 0;
     p->scroll_line = 0; p->scroll_col = 0; p->preferred_col = 0;
@@ -131,7 +137,6 @@ void pane_open_file(Pane *p, const char *path) {
         if (!p->hex) p->hex = hex_new();
         hex_load(p->hex, p->filename);
         p->hex_mode = true;
-        syn_free(p->syn); p->syn = syn_new(LANG_NONE);
     } else {
         p->hex_mode = false;
         int fd = open(path, O_RDONLY);
@@ -142,12 +147,20 @@ void pane_open_file(Pane *p, const char *path) {
                 void *m = mmap(NULL, sz, PROT_READ, MAP_PRIVATE, fd, 0);
                 if (m != MAP_FAILED) {
                     const char *src = (const char *)m;
-                    /* Detect and strip \r\n → \n (CRLF files) */
-                    p->crlf = false;
-                    for (size_t i = 0; i + 1 < sz; i++) {
-                        if (src[i] == '\r' && src[i+1] == '\n') { p->crlf = true; break; }
+                    /* Detect and strip \r\n → \n (CRLF files).  Large files
+                       are judged by their first line ending, so opening
+                       does not have to touch every page. */
+                    if (sz >= PT_MAP_THRESHOLD) {
+                        const char *nl = memchr(src, '\n', sz);
+                        p->crlf = nl && nl > src && nl[-1] == '\r';
+                    } else {
+                        p->crlf = memmem(src, sz, "\r\n", 2) != NULL;
                     }
-                    if (p->crlf) {
+                    if (!p->crlf && sz >= PT_MAP_THRESHOLD) {
+                        /* Large LF file: keep the mapping, edit via pieces */
+                        gb_free(p->buf);
+                        p->buf = gb_new_mapped(src, sz);
+                    } else if (p->crlf) {
                         char *buf = malloc(sz);
                         size_t j = 0;
                         for (size_t i = 0; i < sz; i++) {
@@ -159,24 +172,50 @@ void pane_open_file(Pane *p, const char *path) {
                     } else {
                         gb_insert_str(p->buf, 0, src, sz);
                     }
-                    munmap(m, sz);
+                    if (!p->buf->pt) munmap(m, sz);
                 }
             }
             close(fd);
         }
-        syn_free(p->syn); p->syn = syn_new(p->lang);
+        p->syn->lang = p->lang;
+        us_load(p->undo, p->filename, p->buf);
     }
 
-    li_rebuild(p->li, p->buf);
-}
-
-typedef struct { char path[4096]; char *data; size_t len; } SaveArgs;
-static void *save_thread_fn(void *arg) {
-    SaveArgs *sa = arg;
-    FILE *f = fopen(sa->path, "w");
-    if (f) { fwrite(sa->data, 1, sa->len, f); fclose(f); }
-    free(sa->data); free(sa);
-    return NULL;
+    /* Mapped files are indexed in the background, first screen first */
+    if (p->buf->pt)
+        li_build_async(p->li, p->buf->pt->orig->data, p->buf->pt->orig->len);
+    else
+        li_rebuild(p->li, p->buf);
+}
+
+/* Write snap to a sibling temp file, flush it to disk and rename it over
+   path, keeping the original mode.  Never truncating path in place also
+   matters to piece-table buffers, which still read its old inode through
+   their mapping.  Returns 0 or an errno value. */
+int pane_write_atomic(const char *path, const GapBuf *snap, bool crlf) {
+    char tmp[4200];
+    snprintf(tmp, sizeof tmp, "%s.abyss~", path);
+    struct stat st;
+    bool existed = stat(path, &st) == 0;
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) return errno;
+    int err = 0;
+    if (existed && fchmod(fd, st.st_mode & 07777) != 0) err = errno;
+    if (!err && !gb_write(snap, fd, crlf)) err = errno;
+    if (!err && fdatasync(fd) != 0)        err = errno;
+    if (close(fd) != 0 && !err)            err = errno;
+    if (!err && rename(tmp, path) != 0)    err = errno;
+    if (err) { unlink(tmp); return err; }
+
+    /* Make the rename itself durable */
+    char dir[4096];
+    snprintf(dir, sizeof dir, "%s", path);
+    char *slash = strrchr(dir, '/');
+    if (slash) *(slash == dir ? slash + 1 : slash) = '\0';
+    else strcpy(dir, ".");
+    int dfd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (dfd >= 0) { fsync(dfd); close(dfd); }
+    return 0;
 }
 
 bool pane_save_file(Pane *p, const char *path) {
@@ -184,38 +223,27 @@ bool pane_save_file(Pane *p, const char *path) {
     if (p->hex_mode && p->hex)
         return hex_save(p->hex, path);
 
-    if (path && path[0]) strncpy(p->filename, path, sizeof(p->filename)-1);
-    if (!p->filename[0]) return false;
-    char *s = gb_to_str(p->buf);
-    size_t slen = strlen(s);
-
-    /* Re-add \r\n if file originally used CRLF */
-    char *out = s; size_t outlen = slen;
-    if (p->crlf) {
-        /* Count \n to know how much space we need */
-        size_t newlines = 0;
-        for (size_t i = 0; i < slen; i++) if (s[i] == '\n') newlines++;
-        out = malloc(slen + newlines + 1);
-        size_t j = 0;
-        for (size_t i = 0; i < slen; i++) {
-            if (s[i] == '\n') out[j++] = '\r';
-            out[j++] = s[i];
-        }
-        out[j] = '\0'; outlen = j;
-        free(s);
+    if (path && path[0] && strcmp(path, p->filename) != 0) {
+        strncpy(p->filename, path, sizeof(p->filename)-1);
+        p->undo->journaled = false;
     }
+    if (!p->filename[0]) return false;
 
-    SaveArgs *sa = malloc(sizeof *sa);
-    snprintf(sa->path, sizeof(sa->path), "%s", p->filename);
-    sa->data = out; sa->len = outlen;
-    pthread_t tid;
-    pthread_create(&tid, NULL, save_thread_fn, sa);
-    pthread_detach(tid);
+    /* The save worker streams a snapshot (pieces only for mapped files),
+       re-adding \r\n on the way out if the file used CRLF, then hashes
+       it into the undo journal queued along */
+    UjWrite *uj = us_save(p->undo, p->filename, p->buf);
+    editor_queue_save(p->filename, gb_clone(p->buf), p->crlf, uj);
     p->modified = false;
+    /* Saving under a new extension may change the language; otherwise the
+       highlighter state is still good */
     const char *ext = strrchr(p->filename, '.');
-    p->lang = lang_from_ext(ext ? ext : "");
-    syn_free(p->syn); p->syn = syn_new(p->lang);
-    syn_mark_dirty_from(p->syn, 0);
+    Language lang = lang_from_ext(ext ? ext : "");
+    if (lang != p->lang) {
+        p->lang = lang;
+        syn_free(p->syn); p->syn = syn_new(p->lang);
+        syn_mark_dirty_from(p->syn, 0);
+    }
     return true;
 }
 
@@ -234,12 +262,20 @@ void pane_set_window(Pane *p, WINDOW *w, int y, int x, int h, int ww) {
     idlok(w, FALSE);
 }
 
+/* Bring the line index up to date; all also waits for background
+   indexing.  The highlighter reads the index from its thread, hence the
+   lock around anything that rewrites it. */
+static void pane_sync_li(Pane *p, bool all) {
+    if (!p->li->dirty && !(all && p->li->bg)) return;
+    syn_lock(p->syn);
+    if (p->li->dirty) li_rebuild(p->li, p->buf);
+    if (all) li_wait(p->li);
+    syn_unlock(p->syn);
+}
+
 static void cursor_update_line_col(Pane *p) {
-    size_t lo = 0, hi = li_line_count(p->li);
-    while (lo + 1 < hi) {
-        size_t mid = (lo + hi) / 2;
-        if (li_line_start(p->li, mid) <= p->cursor) lo = mid; else hi = mid;
-    }
+    if (!li_covers(p->li, p->cursor)) pane_sync_li(p, true);
+    size_t lo = li_line_of(p->li, p->cursor);
     p->cursor_line = lo;
     /* cursor_col = visual column, not byte offset */
     size_t line_start = li_line_start(p->li, lo);
@@ -279,15 +315,21 @@ void pane_render(Pane *p, bool force) {
 
     (void)force;
     if (!p->win || p->win_h < 1 || p->win_w < 1) return;
+    syn_lock(p->syn);
     if (p->li->dirty) li_rebuild(p->li, p->buf);
+    li_poll(p->li);
+    syn_unlock(p->syn);
 
     int gutter = p->show_line_numbers ? 6 : 0;
     int text_w = p->win_w - gutter; if (text_w < 1) text_w = 1;
     size_t nlines = li_line_count(p->li);
-    size_t buflen  = gb_len(p->buf);
+    size_t qlen   = strlen(p->search.query);
 
-    for (size_t i = 0; i < p->scroll_line && i < nlines; i++)
-        syn_ensure_line(p->syn, i, p->buf, p->li);
+    /* Lexing happens on the highlighter thread; lines it has not reached
+       yet are drawn with whatever attrs they have (or plain).  Holds the
+       syntax lock until the lines are drawn. */
+    syn_view(p->syn, p->buf, p->li, p->scroll_line,
+             p->scroll_line + (size_t)p->win_h, SYN_RENDER_WAIT_MS);
 
     for (int row = 0; row < p->win_h; row++) {
         size_t lineno     = p->scroll_line + row;
@@ -301,9 +343,8 @@ void pane_render(Pane *p, bool force) {
             continue;
         }
 
-        syn_ensure_line(p->syn, lineno, p->buf, p->li);
         size_t line_start = li_line_start(p->li, lineno);
-        size_t line_end   = (lineno + 1 < nlines) ? li_line_start(p->li, lineno+1)-1 : buflen;
+        size_t line_end   = li_line_end(p->li, lineno, p->buf);
         size_t line_len   = (line_end >= line_start) ? line_end - line_start : 0;
 
         if (p->show_line_numbers) {
@@ -316,7 +357,15 @@ void pane_render(Pane *p, bool force) {
             wattroff(p->win, COLOR_PAIR(COLOR_PAIR_OPERATOR));
         }
 
-        LineAttr *la = &p->syn->lines[lineno];
+        LineAttr *la = syn_line(p->syn, lineno);
+
+        /* The part of the line that can reach the screen, as plain memory
+           (at most 4 bytes per column, and a match running past it) */
+        static char  *scratch;
+        static size_t scap;
+        size_t view = min_sz(line_len, (p->scroll_col + (size_t)text_w) * 4 + 16 + qlen);
+        const char *text = gb_span(p->buf, line_start, view, &scratch, &scap);
+        size_t view_end = line_start + view;
 
         /* UTF-8 aware rendering:
            - iterate by codepoint (byte pos), track visual column
@@ -325,29 +374,42 @@ void pane_render(Pane *p, bool force) {
         size_t vis_col  = 0;          /* current visual column on this line */
 
         /* Skip characters that are scrolled off to the left */
-        while (byte_pos < line_start + line_len) {
-            uint32_t cp; char tmp[4];
-            int blen_cp = utf8_byte_len((unsigned char)gb_at(p->buf, byte_pos));
-            int avail = (int)(line_start + line_len - byte_pos);
+        while (byte_pos < view_end) {
+            uint32_t cp;
+            const char *cs = text + (byte_pos - line_start);
+            int blen_cp = utf8_byte_len((unsigned char)*cs);
+            int avail = (int)(view_end - byte_pos);
             if (blen_cp > avail) blen_cp = avail;
-            for (int i = 0; i < blen_cp; i++) tmp[i] = gb_at(p->buf, byte_pos + i);
-            utf8_decode(tmp, (size_t)blen_cp, &cp);
+            utf8_decode(cs, (size_t)blen_cp, &cp);
             int w = (cp == '\t') ? (int)(((vis_col/4)+1)*4 - vis_col) : utf8_cp_width(cp);
             if (vis_col + (size_t)w > p->scroll_col) break;
             vis_col += (size_t)w;
             byte_pos += (size_t)blen_cp;
         }
 
+        /* Token runs are walked along with byte_pos; attributes only
+           change where the run, selection or cursor does */
+        const uint8_t *run = la->runs, *run_last = la->runs + la->runs_len;
+        size_t    run_end = 0;
+        TokenType run_tok = TOK_NORMAL;
+        attr_t attr = A_NORMAL;
+
+        /* Search matches are an overlay on top of the runs, found in the
+           visible text as it is drawn (a regex sees the whole line) */
+        size_t hl_e, hl_end = 0;
+        size_t hl_next = search_next_in(&p->search, p->buf, line_start, text, view,
+                                        0, &hl_e);
+
         /* Render visible characters */
         int screen_col = 0; /* columns written to screen so far */
-        while (byte_pos < line_start + line_len && screen_col < text_w - 1) {
+        while (byte_pos < view_end && screen_col < text_w - 1) {
             /* Decode codepoint */
-            char tmp[4]; uint32_t cp;
-            int blen_cp = utf8_byte_len((unsigned char)gb_at(p->buf, byte_pos));
-            int avail = (int)(line_start + line_len - byte_pos);
+            uint32_t cp;
+            const char *cs = text + (byte_pos - line_start);
+            int blen_cp = utf8_byte_len((unsigned char)*cs);
+            int avail = (int)(view_end - byte_pos);
             if (blen_cp > avail) blen_cp = avail;
-            for (int i = 0; i < blen_cp; i++) tmp[i] = gb_at(p->buf, byte_pos + i);
-            utf8_decode(tmp, (size_t)blen_cp, &cp);
+            utf8_decode(cs, (size_t)blen_cp, &cp);
 
             int w; /* visual width of this char */
             if (cp == '\t') {
@@ -362,9 +424,16 @@ void pane_render(Pane *p, bool force) {
             /* Don't overflow the line width */
             if (screen_col + w > text_w) break;
 
-            /* Determine token type using byte offset into line attrs */
+            /* Token type of the run holding this byte */
             size_t ci = byte_pos - line_start; /* byte offset within line */
-            TokenType tok = (la->attrs && ci < la->len) ? la->attrs[ci] : TOK_NORMAL;
+            while (ci >= run_end && run < run_last) run_tok = syn_run(&run, &run_end);
+            TokenType tok = ci < run_end ? run_tok : TOK_NORMAL;
+            while (ci >= hl_next && hl_next < view) {
+                hl_end  = max_sz(hl_end, hl_e);
+                hl_next = search_next_in(&p->search, p->buf, line_start, text, view,
+                                         max_sz(hl_next + 1, hl_e), &hl_e);
+            }
+            if (ci < hl_end) tok = TOK_SEARCH;
 
             bool sel = false;
             if (p->sel_active) {
@@ -374,14 +443,14 @@ void pane_render(Pane *p, bool force) {
             }
             bool cur = (byte_pos == p->cursor);
 
-            wstandend(p->win);
-            if      (cur) wattron(p->win, A_REVERSE);
-            else if (sel) wattron(p->win, COLOR_PAIR(COLOR_PAIR_SELECTION));
+            attr_t a;
+            if      (cur) a = A_REVERSE;
+            else if (sel) a = COLOR_PAIR(COLOR_PAIR_SELECTION);
             else {
-                int color_pair = tok_to_color_pair(tok);
-                wattron(p->win, COLOR_PAIR(color_pair));
-                if (tok == TOK_KEYWORD || tok == TOK_TYPE) wattron(p->win, A_BOLD);
+                a = COLOR_PAIR(tok_to_color_pair(tok));
+                if (tok == TOK_KEYWORD || tok == TOK_TYPE) a |= A_BOLD;
             }
+            if (a != attr) { wattrset(p->win, a); attr = a; }
 
             if (cp == '\t') {
                 for (int i = 0; i < w; i++) waddch(p->win, ' ');
@@ -389,8 +458,7 @@ void pane_render(Pane *p, bool force) {
                 waddch(p->win, (chtype)cp);
             } else {
                 /* Multi-byte: write raw UTF-8 bytes */
-                tmp[blen_cp] = '\0';
-                waddstr(p->win, tmp);
+                waddnstr(p->win, cs, blen_cp);
             }
 
             vis_col    += (size_t)w;
@@ -404,86 +472,96 @@ void pane_render(Pane *p, bool force) {
         }
         wclrtoeol(p->win);
     }
+    syn_unlock(p->syn);
     if (p->cursor_line >= p->scroll_line &&
         (int)(p->cursor_line - p->scroll_line) < p->win_h)
         p->last_cursor_row = p->cursor_line - p->scroll_line;
     wnoutrefresh(p->win);
 }
 
-static void mark_dirty(Pane *p) {
-    li_mark_dirty(p->li);
-    syn_mark_dirty_from(p->syn, p->cursor_line > 0 ? p->cursor_line-1 : 0);
+/* Apply [pos, pos+del) -> ins[0..n) to the buffer, line index and syntax. */
+static void apply_edit(Pane *p, size_t pos, size_t del, const char *ins, size_t n) {
+    search_cancel(&p->search);      /* search workers read the buffer */
+    syn_lock(p->syn);
+    if (p->li->dirty) li_rebuild(p->li, p->buf);
+    size_t line  = li_line_of(p->li, pos);
+    size_t old_n = li_line_of(p->li, pos + del) - line + 1;
+    size_t nl    = li_line_count(p->li);
+    if (del) gb_delete(p->buf, pos, del);
+    if (n)   gb_insert_str(p->buf, pos, ins, n);
+    li_edit(p->li, p->buf, pos, del, n);
+    syn_edit(p->syn, line, old_n, old_n + li_line_count(p->li) - nl);
+    syn_unlock(p->syn);
     p->modified = true;
 }
 
+/* Every text change goes through here so it lands in the undo log. */
+void pane_replace(Pane *p, size_t pos, size_t del, const char *ins, size_t n,
+                  size_t cursor_after) {
+    us_push(p->undo, p->buf, pos, del, ins, n, p->cursor, cursor_after);
+    apply_edit(p, pos, del, ins, n);
+    p->cursor = cursor_after;
+}
+
+/* A keystroke edit: may merge into the previous undo record. */
+static void pane_type(Pane *p, size_t pos, size_t del, const char *ins, size_t n,
+                      size_t cursor_after) {
+    us_type(p->undo, p->buf, pos, del, ins, n, p->cursor, cursor_after);
+    apply_edit(p, pos, del, ins, n);
+    p->cursor = cursor_after;
+}
+
 static void auto_indent_newline(Pane *p) {
-    if (p->li->dirty) li_rebuild(p->li, p->buf);
+    pane_sync_li(p, false);
     size_t ls = li_line_start(p->li, p->cursor_line);
     size_t blen = gb_len(p->buf);
     size_t indent = 0;
-    while (ls + indent < blen) {
-        char c = gb_at(p->buf, ls + indent);
-        if (c == ' ' || c == '\t') indent++; else break;
+    GbIter it; const char *run; size_t rn;
+    gb_iter(&it, p->buf, ls, blen);
+    while ((rn = gb_iter_next(&it, &run))) {
+        size_t k = 0;
+        while (k < rn && (run[k] == ' ' || run[k] == '\t')) k++;
+        indent += k;
+        if (k < rn || indent > 255) break;
     }
     if (indent > 255) indent = 255;
-    char spaces[256] = {0}; memset(spaces, ' ', indent);
     char prev_c = p->cursor > 0    ? gb_at(p->buf, p->cursor-1) : 0;
     char next_c = p->cursor < blen ? gb_at(p->buf, p->cursor)   : 0;
-    pane_push_undo(p);
+    char ins[2 * 255 + 6]; size_t n = 0;
+    ins[n++] = '\n';
+    memset(ins+n, ' ', indent); n += indent;
+    if (prev_c == '{') { memcpy(ins+n, "    ", 4); n += 4; }
+    size_t cur = p->cursor + n;
     if (prev_c == '{' && next_c == '}') {
-        size_t n = 1 + indent + 4 + 1 + indent;
-        char *ins = malloc(n+1); size_t pos = 0;
-        ins[pos++] = '\n';
-        memcpy(ins+pos, spaces, indent); pos += indent;
-        memcpy(ins+pos, "    ", 4);      pos += 4;
-        ins[pos++] = '\n';
-        memcpy(ins+pos, spaces, indent); pos += indent;
-        ins[pos] = '\0';
-        gb_insert_str(p->buf, p->cursor, ins, n);
-        p->cursor += 1 + indent + 4;
-        free(ins);
-    } else {
-        bool extra = (prev_c == '{');
-        gb_insert_char(p->buf, p->cursor, '\n'); p->cursor++;
-        gb_insert_str(p->buf, p->cursor, spaces, indent); p->cursor += indent;
-        if (extra) { gb_insert_str(p->buf, p->cursor, "    ", 4); p->cursor += 4; }
+        ins[n++] = '\n';
+        memset(ins+n, ' ', indent); n += indent;
     }
-    mark_dirty(p);
-    li_rebuild(p->li, p->buf);
+    pane_replace(p, p->cursor, 0, ins, n, cur);
     cursor_update_line_col(p);
     p->preferred_col = p->cursor_col;
     pane_scroll_to_cursor(p);
 }
 
-void pane_push_undo(Pane *p) { us_push(p->undo, p->buf, p->cursor); }
-
 void pane_insert_char(Pane *p, char c) {
     if (c == '\n') { auto_indent_newline(p); return; }
     const char *open = "{([\"'", *close = "})]\"'";
     const char *cp = strchr(open, c);
     if (cp) {
-        char cl = close[cp-open];
-        gb_insert_char(p->buf, p->cursor, c);
-        gb_insert_char(p->buf, p->cursor+1, cl);
-        p->cursor++;
+        char pair[2] = { c, close[cp-open] };
+        pane_replace(p, p->cursor, 0, pair, 2, p->cursor + 1);
     } else {
         const char *clp = strchr(close, c);
         if (clp && p->cursor < gb_len(p->buf) && gb_at(p->buf, p->cursor) == c)
-            { p->cursor++; goto done; }
-        gb_insert_char(p->buf, p->cursor, c); p->cursor++;
+            p->cursor++;
+        else
+            pane_type(p, p->cursor, 0, &c, 1, p->cursor + 1);
     }
-    pane_push_undo(p); /* push APRÈS insertion avec curseur correct */
-done:
-    mark_dirty(p);
-    li_rebuild(p->li, p->buf);
     cursor_update_line_col(p);
     pane_scroll_to_cursor(p);
 }
 
 void pane_insert_str(Pane *p, const char *s, size_t n) {
-    pane_push_undo(p);
-    gb_insert_str(p->buf, p->cursor, s, n); p->cursor += n;
-    mark_dirty(p); li_rebuild(p->li, p->buf);
+    pane_replace(p, p->cursor, 0, s, n, p->cursor + n);
     cursor_update_line_col(p); p->preferred_col = p->cursor_col; pane_scroll_to_cursor(p);
 }
 
@@ -496,29 +574,24 @@ void pane_delete_char(Pane *p) {
     char prev = gb_at(p->buf, prev_pos);
     const char *open = "{([\"'", *close = "})]\"'";
     const char *cp = strchr(open, prev);
-    if (back == 1 && cp && p->cursor < blen && gb_at(p->buf, p->cursor) == close[cp-open]) {
-        gb_delete(p->buf, prev_pos, 2); p->cursor = prev_pos;
-    } else {
-        gb_delete(p->buf, prev_pos, back); p->cursor = prev_pos;
-    }
-    pane_push_undo(p);
-    mark_dirty(p); li_rebuild(p->li, p->buf);
+    if (back == 1 && cp && p->cursor < blen && gb_at(p->buf, p->cursor) == close[cp-open])
+        pane_replace(p, prev_pos, 2, NULL, 0, prev_pos);
+    else
+        pane_type(p, prev_pos, back, NULL, 0, prev_pos);
     cursor_update_line_col(p); p->preferred_col = p->cursor_col; pane_scroll_to_cursor(p);
 }
 
 void pane_delete_forward(Pane *p) {
     size_t len = gb_len(p->buf);
     if (p->cursor >= len) return;
-    pane_push_undo(p);
     size_t adv = gb_next_cp(p->buf, p->cursor);
     if (adv == 0) adv = 1;
-    gb_delete(p->buf, p->cursor, adv);
-    mark_dirty(p); li_rebuild(p->li, p->buf);
+    pane_type(p, p->cursor, adv, NULL, 0, p->cursor);
     cursor_update_line_col(p); p->preferred_col = p->cursor_col; pane_scroll_to_cursor(p);
 }
 
 void pane_move_cursor(Pane *p, int dy, int dx) {
-    if (p->li->dirty) li_rebuild(p->li, p->buf);
+    pane_sync_li(p, false);
     if (dy != 0) {
         /* Vertical: use preferred_col (visual), find closest byte offset */
         size_t nl = li_line_count(p->li);
@@ -526,9 +599,7 @@ void pane_move_cursor(Pane *p, int dy, int dx) {
         if (tl < 0) tl = 0;
         if ((size_t)tl >= nl) tl = (long)nl - 1;
         size_t ls  = li_line_start(p->li, (size_t)tl);
-        size_t nls = ((size_t)tl+1 < nl)
-                     ? li_line_start(p->li, (size_t)tl+1) - 1
-                     : gb_len(p->buf);
+        size_t nls = li_line_end(p->li, (size_t)tl, p->buf);
         size_t ll  = nls >= ls ? nls - ls : 0;
         size_t byte_off = vis_col_to_byte_offset(p->buf, ls, ll, p->preferred_col);
         p->cursor = ls + byte_off;
@@ -552,7 +623,7 @@ void pane_move_cursor(Pane *p, int dy, int dx) {
 }
 
 void pane_move_to_line_col(Pane *p, size_t line, size_t col) {
-    if (p->li->dirty) li_rebuild(p->li, p->buf);
+    pane_sync_li(p, line >= li_line_count(p->li));
     size_t nl = li_line_count(p->li);
     if (line >= nl) line = nl > 0 ? nl-1 : 0;
     size_t ls = li_line_start(p->li, line);
@@ -563,49 +634,44 @@ void pane_move_to_line_col(Pane *p, size_t line, size_t col) {
 }
 
 void pane_kill_line(Pane *p) {
-    if (p->li->dirty) li_rebuild(p->li, p->buf);
-    size_t nl = li_line_count(p->li);
-    size_t le = (p->cursor_line+1 < nl)
-                ? li_line_start(p->li, p->cursor_line+1) - 1
-                : gb_len(p->buf);
+    pane_sync_li(p, false);
+    size_t le = li_line_end(p->li, p->cursor_line, p->buf);
     size_t n = 0;
     if (p->cursor < le)                  n = le - p->cursor;
     else if (p->cursor < gb_len(p->buf)) n = 1;
     if (!n) return;
-    pane_push_undo(p);
-    gb_delete(p->buf, p->cursor, n);
-    mark_dirty(p); li_rebuild(p->li, p->buf);
+    pane_replace(p, p->cursor, n, NULL, 0, p->cursor);
     cursor_update_line_col(p);
 }
 
 void pane_kill_whole_line(Pane *p) {
-    if (p->li->dirty) li_rebuild(p->li, p->buf);
+    pane_sync_li(p, true);
     size_t nl = li_line_count(p->li);
     size_t ls = li_line_start(p->li, p->cursor_line);
     size_t le = (p->cursor_line+1 < nl)
                 ? li_line_start(p->li, p->cursor_line+1)
                 : gb_len(p->buf);
-    pane_push_undo(p);
-    gb_delete(p->buf, ls, le-ls); p->cursor = ls;
-    mark_dirty(p); li_rebuild(p->li, p->buf);
+    pane_replace(p, ls, le-ls, NULL, 0, ls);
     cursor_update_line_col(p); p->preferred_col = p->cursor_col; pane_scroll_to_cursor(p);
 }
 
 void pane_undo(Pane *p) {
-    GapBuf *nb = NULL; size_t nc = 0;
-    if (us_undo(p->undo, &nb, &nc)) {
-        gb_free(p->buf); p->buf = nb; p->cursor = nc;
-        mark_dirty(p); li_rebuild(p->li, p->buf);
-        cursor_update_line_col(p); p->preferred_col = p->cursor_col; pane_scroll_to_cursor(p);
-    }
+    size_t n;
+    const UndoRec *r = us_undo(p->undo, &n);
+    if (!r) return;
+    for (size_t i = n; i-- > 0; )
+        apply_edit(p, r[i].pos, r[i].ins_len, r[i].del, r[i].del_len);
+    p->cursor = r->cursor_before;
+    cursor_update_line_col(p); p->preferred_col = p->cursor_col; pane_scroll_to_cursor(p);
 }
 void pane_redo(Pane *p) {
-    GapBuf *nb = NULL; size_t nc = 0;
-    if (us_redo(p->undo, &nb, &nc)) {
-        gb_free(p->buf); p->buf = nb; p->cursor = nc;
-        mark_dirty(p); li_rebuild(p->li, p->buf);
-        cursor_update_line_col(p); p->preferred_col = p->cursor_col; pane_scroll_to_cursor(p);
-    }
+    size_t n;
+    const UndoRec *r = us_redo(p->undo, &n);
+    if (!r) return;
+    for (size_t i = 0; i < n; i++)
+        apply_edit(p, r[i].pos, r[i].del_len, r[i].ins, r[i].ins_len);
+    p->cursor = r[n-1].cursor_after;
+    cursor_update_line_col(p); p->preferred_col = p->cursor_col; pane_scroll_to_cursor(p);
 }
 
 void pane_copy(Pane *p) {
@@ -625,18 +691,13 @@ void pane_cut(Pane *p) {
     pane_copy(p);
     size_t s0 = min_sz(p->sel_anchor, p->cursor);
     size_t s1 = max_sz(p->sel_anchor, p->cursor);
-    pane_push_undo(p);
-    gb_delete(p->buf, s0, s1-s0); p->cursor = s0;
-    mark_dirty(p); li_rebuild(p->li, p->buf);
+    pane_replace(p, s0, s1-s0, NULL, 0, s0);
     cursor_update_line_col(p);
 }
 
 void pane_paste(Pane *p) {
     if (!p->clip.text || !p->clip.len) return;
-    pane_push_undo(p);
-    gb_insert_str(p->buf, p->cursor, p->clip.text, p->clip.len);
-    p->cursor += p->clip.len;
-    mark_dirty(p); li_rebuild(p->li, p->buf);
+    pane_replace(p, p->cursor, 0, p->clip.text, p->clip.len, p->cursor + p->clip.len);
     cursor_update_line_col(p); p->preferred_col = p->cursor_col; pane_scroll_to_cursor(p);
 }
 
@@ -644,20 +705,34 @@ void pane_search_next(Pane *p) {
     if (!p->search.count) return;
     p->search.current = (p->search.current + 1) % (int)p->search.count;
     p->cursor = p->search.matches[p->search.current];
-    mark_dirty(p); li_rebuild(p->li, p->buf); cursor_update_line_col(p); p->preferred_col = p->cursor_col; pane_scroll_to_cursor(p);
+    cursor_update_line_col(p); p->preferred_col = p->cursor_col; pane_scroll_to_cursor(p);
 }
 
 void pane_search_prev(Pane *p) {
     if (!p->search.count) return;
     p->search.current = (p->search.current - 1 + (int)p->search.count) % (int)p->search.count;
     p->cursor = p->search.matches[p->search.current];
-    mark_dirty(p); li_rebuild(p->li, p->buf); cursor_update_line_col(p); p->preferred_col = p->cursor_col; pane_scroll_to_cursor(p);
+    cursor_update_line_col(p); p->preferred_col = p->cursor_col; pane_scroll_to_cursor(p);
 }
 
 void pane_wipe_file(Pane *p) {
+    /* Une sauvegarde en attente réécrirait le fichier et son journal */
+    if (p->filename[0]) editor_drop_saves(p->filename);
     struct stat _st;
     bool file_exists = p->filename[0] && stat(p->filename, &_st) == 0;
 
+    /* Vider le buffer éditeur avant le shred (un buffer mappé lit encore
+       le fichier) et jeter l'historique : le texte effacé ne doit pas
+       survivre dans l'undo.  Le surligneur et la recherche d'abord, ils
+       lisent le buffer depuis leurs threads */
+    syn_free(p->syn); p->syn = syn_new(p->lang);
+    search_clear(&p->search);
+    li_free(p->li);   p->li  = li_new();
+    gb_free(p->buf);  p->buf = gb_new(GAP_DEFAULT);
+    li_rebuild(p->li, p->buf);
+    us_free(p->undo); p->undo = us_new();
+
+    if (p->filename[0]) us_forget(p->filename);
     if (file_exists) {
         /* Fichier sur disque : shred puis vider */
         char cmd[4200];
@@ -665,15 +740,10 @@ void pane_wipe_file(Pane *p) {
         int _r = system(cmd); (void)_r;
         p->filename[0] = '\0';
     }
-    /* Dans tous les cas : vider le buffer éditeur */
-    gb_free(p->buf); p->buf = gb_new(GAP_DEFAULT);
-    li_free(p->li);  p->li  = li_new();
-    syn_free(p->syn); p->syn = syn_new(p->lang);
-    li_rebuild(p->li, p->buf);
     p->cursor = 0; p->cursor_line = 0; p->cursor_col = 0;
     p->scroll_line = 0; p->scroll_col = 0; p->preferred_col = 0;
+    p->sel_active = false;
     p->modified = false;
-    pane_push_undo(p); mark_dirty(p);
 }
 
 void pane_cursor_line_col(const Pane *p, size_t *line, size_t *col) {
@@ -0,0 +1,173 @@
+#include "abyss.h"
+
+/* Piece table over a read-only file mapping.  The original text is never
+   copied: every piece points either into the mapping (PIECE_ORIG) or into
+   the append-only add buffer (PIECE_ADD).  Pieces are never empty. */
+
+#define PT_ADD_DEFAULT 4096
+
+PieceTable *pt_new_mapped(const char *data, size_t len) {
+    PieceTable *pt = calloc(1, sizeof *pt);
+    pt->orig = malloc(sizeof *pt->orig);
+    pt->orig->data = data;
+    pt->orig->len  = len;
+    pt->orig->refs = 1;
+    pt->add_cap = PT_ADD_DEFAULT;
+    pt->add     = malloc(pt->add_cap);
+    pt->pcap    = 16;
+    pt->pieces  = malloc(pt->pcap * sizeof(Piece));
+    pt->offs    = malloc(pt->pcap * sizeof(size_t));
+    if (len > 0) {
+        pt->pieces[0] = (Piece){ PIECE_ORIG, 0, len };
+        pt->offs[0]   = 0;
+        pt->npieces   = 1;
+    }
+    pt->len = len;
+    return pt;
+}
+
+PieceTable *pt_clone(const PieceTable *pt) {
+    PieceTable *n = malloc(sizeof *n);
+    *n = *pt;
+    __atomic_add_fetch(&n->orig->refs, 1, __ATOMIC_RELAXED);
+    n->add    = malloc(pt->add_cap);
+    n->pieces = malloc(pt->pcap * sizeof(Piece));
+    n->offs   = malloc(pt->pcap * sizeof(size_t));
+    memcpy(n->add,    pt->add,    pt->add_len);
+    memcpy(n->pieces, pt->pieces, pt->npieces * sizeof(Piece));
+    memcpy(n->offs,   pt->offs,   pt->npieces * sizeof(size_t));
+    return n;
+}
+
+void pt_free(PieceTable *pt) {
+    if (!pt) return;
+    /* Save snapshots are released on the I/O thread */
+    if (__atomic_sub_fetch(&pt->orig->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        if (pt->orig->len > 0)
+            munmap((void *)pt->orig->data, pt->orig->len);
+        free(pt->orig);
+    }
+    free(pt->add);
+    free(pt->pieces);
+    free(pt->offs);
+    free(pt);
+}
+
+static const char *piece_data(const PieceTable *pt, const Piece *pc) {
+    return (pc->src == PIECE_ORIG ? pt->orig->data : pt->add) + pc->start;
+}
+
+/* Index of the piece containing pos (npieces when pos == len). */
+static size_t pt_find(const PieceTable *pt, size_t pos) {
+    size_t lo = 0, hi = pt->npieces;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (pt->offs[mid] + pt->pieces[mid].len <= pos) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/* Replace pieces[k..k+nrem) with ins[0..nins), dropping empty pieces. */
+static void pt_splice(PieceTable *pt, size_t k, size_t nrem,
+                      const Piece *ins, size_t nins) {
+    size_t need = pt->npieces - nrem + nins;
+    if (need > pt->pcap) {
+        while (pt->pcap < need) pt->pcap *= 2;
+        pt->pieces = realloc(pt->pieces, pt->pcap * sizeof(Piece));
+        pt->offs   = realloc(pt->offs,   pt->pcap * sizeof(size_t));
+    }
+    size_t keep = 0;
+    for (size_t i = 0; i < nins; i++) if (ins[i].len) keep++;
+    memmove(pt->pieces + k + keep, pt->pieces + k + nrem,
+            (pt->npieces - k - nrem) * sizeof(Piece));
+    for (size_t i = 0, j = k; i < nins; i++)
+        if (ins[i].len) pt->pieces[j++] = ins[i];
+    pt->npieces = pt->npieces - nrem + keep;
+
+    size_t off = k > 0 ? pt->offs[k-1] + pt->pieces[k-1].len : 0;
+    for (size_t i = k; i < pt->npieces; i++) {
+        pt->offs[i] = off;
+        off += pt->pieces[i].len;
+    }
+}
+
+char pt_at(const PieceTable *pt, size_t i) {
+    size_t k = pt_find(pt, i);
+    return piece_data(pt, &pt->pieces[k])[i - pt->offs[k]];
+}
+
+void pt_insert(PieceTable *pt, size_t pos, const char *s, size_t n) {
+    if (n == 0) return;
+    if (pos > pt->len) pos = pt->len;
+    if (pt->add_len + n > pt->add_cap) {
+        while (pt->add_len + n > pt->add_cap) pt->add_cap *= 2;
+        pt->add = realloc(pt->add, pt->add_cap);
+    }
+    size_t add_start = pt->add_len;
+    memcpy(pt->add + add_start, s, n);
+    pt->add_len += n;
+    pt->len += n;
+
+    /* Typing: extend the add piece that ends right at pos */
+    if (pos > 0) {
+        size_t k = pt_find(pt, pos - 1);
+        Piece *pc = &pt->pieces[k];
+        if (pc->src == PIECE_ADD && pt->offs[k] + pc->len == pos &&
+            pc->start + pc->len == add_start) {
+            pc->len += n;
+            for (size_t i = k + 1; i < pt->npieces; i++) pt->offs[i] += n;
+            return;
+        }
+    }
+
+    Piece np = { PIECE_ADD, add_start, n };
+    size_t k = pt_find(pt, pos);
+    if (k == pt->npieces || pt->offs[k] == pos) {
+        pt_splice(pt, k, 0, &np, 1);
+        return;
+    }
+    Piece old = pt->pieces[k];
+    size_t left = pos - pt->offs[k];
+    Piece parts[3] = {
+        { old.src, old.start, left },
+        np,
+        { old.src, old.start + left, old.len - left },
+    };
+    pt_splice(pt, k, 1, parts, 3);
+}
+
+void pt_delete(PieceTable *pt, size_t pos, size_t n) {
+    if (pos >= pt->len) return;
+    if (pos + n > pt->len) n = pt->len - pos;
+    if (n == 0) return;
+    size_t k = pt_find(pt, pos);
+    size_t m = pt_find(pt, pos + n - 1);
+    const Piece *pk = &pt->pieces[k], *pm = &pt->pieces[m];
+    size_t tail = pt->offs[m] + pm->len - (pos + n);
+    Piece parts[2] = {
+        { pk->src, pk->start, pos - pt->offs[k] },
+        { pm->src, pm->start + pm->len - tail, tail },
+    };
+    pt->len -= n;
+    pt_splice(pt, k, m - k + 1, parts, 2);
+}
+
+void pt_get_range(const PieceTable *pt, size_t start, size_t len, char *out) {
+    size_t k = pt_find(pt, start);
+    while (len > 0 && k < pt->npieces) {
+        const Piece *pc = &pt->pieces[k];
+        size_t skip = start - pt->offs[k];
+        size_t n = min_sz(pc->len - skip, len);
+        memcpy(out, piece_data(pt, pc) + skip, n);
+        out += n; start += n; len -= n; k++;
+    }
+}
+
+size_t pt_chunk(const PieceTable *pt, size_t pos, const char **out) {
+    size_t k = pt_find(pt, pos);
+    if (k >= pt->npieces) { *out = NULL; return 0; }
+    size_t skip = pos - pt->offs[k];
+    *out = piece_data(pt, &pt->pieces[k]) + skip;
+    return pt->pieces[k].len - skip;
+}
@@ -0,0 +1,882 @@
+#include "abyss.h"
+
+/* Regular expressions.  A pattern is parsed to a tree, compiled to a
+   Thompson NFA and run as a lazily built DFA, so a search is linear in
+   the text whatever the pattern: no backtracking.
+
+     .  [abc]  [^a-z]  \d \w \s \D \W \S  \n \t \r \xHH
+     ^ $ (line anchors)  \b \B
+     * + ? {m} {m,} {m,n}, lazy with a trailing ?
+     (...)  (?:...)  a|b
+
+   '.' and negated classes don't match '\n', so matches stay within a
+   line unless the pattern asks for one.
+
+   A search takes three passes, as in RE2: the forward DFA, behind a lazy
+   .* prefix, finds where the leftmost-first match ends; the reverse DFA,
+   anchored there, finds where it starts; captures, when asked for, come
+   from a Pike VM run over the match alone. */
+
+#define RE_MAX_INSTS  10000       /* compiled program size */
+#define RE_MAX_REP    1000        /* largest {m,n} count */
+#define RE_MAX_GROUPS 32
+#define RE_DFA_MEM    (8u << 20)  /* DFA cache, flushed when exceeded */
+
+typedef struct { uint8_t bits[32]; } ByteSet;
+
+static bool set_has(const ByteSet *s, int c) { return s->bits[c >> 3] >> (c & 7) & 1; }
+static void set_add(ByteSet *s, int c)       { s->bits[c >> 3] |= (uint8_t)(1 << (c & 7)); }
+static bool is_word(int c)                   { return c >= 0 && (isalnum(c) || c == '_'); }
+
+/* ─── Parser ─────────────────────────────────────────────────── */
+
+enum { N_SET, N_CAT, N_ALT, N_REP, N_GROUP, N_ASSERT, N_EMPTY };
+
+/* Assertions, as seen in the direction of the scan: A_BOL looks at the
+   byte just consumed, A_EOL at the next one.  The reverse program swaps
+   ^ and $. */
+enum { A_BOL, A_EOL, A_WORDB, A_NWORDB };
+
+typedef struct {
+    uint8_t type;
+    bool    greedy;
+    int     a, b;       /* children */
+    int     min, max;   /* N_REP (max -1: unbounded); N_GROUP: min = group
+                           or -1; N_ASSERT: min = kind; N_SET: min = set */
+} Node;
+
+typedef struct {
+    const char *p;
+    const char *err;
+    Node    *n;    int nn, ncap;
+    ByteSet *sets; int nsets, scap;
+    int      groups;
+} Parser;
+
+static int new_node(Parser *ps, int type, int a, int b) {
+    if (ps->nn == ps->ncap) {
+        ps->ncap = ps->ncap ? ps->ncap * 2 : 64;
+        ps->n = realloc(ps->n, ps->ncap * sizeof(Node));
+    }
+    ps->n[ps->nn] = (Node){ .type = (uint8_t)type, .a = a, .b = b, .greedy = true };
+    return ps->nn++;
+}
+
+static int new_set(Parser *ps) {
+    if (ps->nsets == ps->scap) {
+        ps->scap = ps->scap ? ps->scap * 2 : 16;
+        ps->sets = realloc(ps->sets, ps->scap * sizeof(ByteSet));
+    }
+    memset(&ps->sets[ps->nsets], 0, sizeof(ByteSet));
+    return ps->nsets++;
+}
+
+static int set_node(Parser *ps, int set) {
+    int n = new_node(ps, N_SET, -1, -1);
+    ps->n[n].min = set;
+    return n;
+}
+
+/* \d \w \s and their negations into s; false if c is not one of them */
+static bool class_escape(ByteSet *s, int c) {
+    int lc = tolower(c);
+    if (lc != 'd' && lc != 'w' && lc != 's') return false;
+    for (int b = 0; b < 256; b++) {
+        bool in = lc == 'd' ? isdigit(b) : lc == 'w' ? is_word(b)
+                : (b == ' ' || (b >= '\t' && b <= '\r'));
+        if (in != (c != lc) && !(c != lc && b == '\n')) set_add(s, b);
+    }
+    return true;
+}
+
+/* The byte an escape stands for, after the backslash */
+static int escape_byte(Parser *ps) {
+    int c = (unsigned char)*ps->p++;
+    switch (c) {
+    case 'n': return '\n';
+    case 't': return '\t';
+    case 'r': return '\r';
+    case 'f': return '\f';
+    case 'v': return '\v';
+    case '0': return 0;
+    case 'x': {
+        int v = 0, k = 0;
+        for (; k < 2 && isxdigit((unsigned char)*ps->p); k++, ps->p++)
+            v = v * 16 + (isdigit((unsigned char)*ps->p) ? *ps->p - '0'
+                                                         : tolower(*ps->p) - 'a' + 10);
+        if (!k) ps->err = "bad \\x escape";
+        return v;
+    }
+    case '\0': ps->p--; ps->err = "trailing \\"; return 0;
+    default:
+        if (c >= '1' && c <= '9') ps->err = "backreferences are not supported";
+        return c;
+    }
+}
+
+static int parse_class(Parser *ps) {
+    int set = new_set(ps);
+    bool neg = *ps->p == '^';
+    if (neg) ps->p++;
+    bool first = true;
+    while (*ps->p && (*ps->p != ']' || first)) {
+        first = false;
+        int lo;
+        if (*ps->p == '\\') {
+            ps->p++;
+            if (class_escape(&ps->sets[set], *ps->p)) { ps->p++; continue; }
+            lo = escape_byte(ps);
+        } else {
+            lo = (unsigned char)*ps->p++;
+        }
+        int hi = lo;
+        if (ps->p[0] == '-' && ps->p[1] && ps->p[1] != ']') {
+            ps->p++;
+            hi = *ps->p == '\\' ? (ps->p++, escape_byte(ps)) : (unsigned char)*ps->p++;
+            if (hi < lo) ps->err = "bad class range";
+        }
+        for (int c = lo; c <= hi; c++) set_add(&ps->sets[set], c);
+    }
+    if (*ps->p != ']') { ps->err = "missing ]"; return -1; }
+    ps->p++;
+    if (neg) {
+        ByteSet *s = &ps->sets[set];
+        for (int i = 0; i < 32; i++) s->bits[i] = (uint8_t)~s->bits[i];
+        s->bits['\n' >> 3] &= (uint8_t)~(1 << ('\n' & 7));
+    }
+    return set_node(ps, set);
+}
+
+static int parse_alt(Parser *ps);
+
+static int parse_atom(Parser *ps) {
+    int c = (unsigned char)*ps->p++;
+    switch (c) {
+    case '(': {
+        int group = -1;
+        if (ps->p[0] == '?' && ps->p[1] == ':') ps->p += 2;
+        else if (ps->groups < RE_MAX_GROUPS) group = ++ps->groups;
+        else { ps->err = "too many groups"; return -1; }
+        int in = parse_alt(ps);
+        if (ps->err) return -1;
+        if (*ps->p != ')') { ps->err = "missing )"; return -1; }
+        ps->p++;
+        int n = new_node(ps, N_GROUP, in, -1);
+        ps->n[n].min = group;
+        return n;
+    }
+    case '[':
+        return parse_class(ps);
+    case '.': {
+        int set = new_set(ps);
+        memset(&ps->sets[set], 0xff, sizeof(ByteSet));
+        ps->sets[set].bits['\n' >> 3] &= (uint8_t)~(1 << ('\n' & 7));
+        return set_node(ps, set);
+    }
+    case '^': case '$': {
+        int n = new_node(ps, N_ASSERT, -1, -1);
+        ps->n[n].min = c == '^' ? A_BOL : A_EOL;
+        return n;
+    }
+    case '*': case '+': case '?':
+        ps->err = "nothing to repeat";
+        return -1;
+    case '\\': {
+        if (*ps->p == 'b' || *ps->p == 'B') {
+            int n = new_node(ps, N_ASSERT, -1, -1);
+            ps->n[n].min = *ps->p++ == 'b' ? A_WORDB : A_NWORDB;
+            return n;
+        }
+        int set = new_set(ps);
+        if (class_escape(&ps->sets[set], *ps->p)) { ps->p++; return set_node(ps, set); }
+        set_add(&ps->sets[set], escape_byte(ps));
+        return set_node(ps, set);
+    }
+    default: {
+        int set = new_set(ps);
+        set_add(&ps->sets[set], c);
+        return set_node(ps, set);
+    }
+    }
+}
+
+/* {m}, {m,} or {m,n} at p; false (p untouched) if it is not one */
+static bool parse_count(Parser *ps, int *min, int *max) {
+    const char *q = ps->p + 1;
+    if (!isdigit((unsigned char)*q)) return false;
+    long m = strtol(q, (char **)&q, 10), n = m;
+    if (*q == ',') {
+        q++;
+        n = isdigit((unsigned char)*q) ? strtol(q, (char **)&q, 10) : -1;
+    }
+    if (*q != '}') return false;
+    ps->p = q + 1;
+    if (m > RE_MAX_REP || n > RE_MAX_REP) { ps->err = "repeat count too large"; return true; }
+    if (n >= 0 && n < m) { ps->err = "bad repeat range"; return true; }
+    *min = (int)m; *max = (int)n;
+    return true;
+}
+
+static int parse_rep(Parser *ps) {
+    int x = parse_atom(ps);
+    while (!ps->err) {
+        int min, max;
+        if      (*ps->p == '*') { min = 0; max = -1; ps->p++; }
+        else if (*ps->p == '+') { min = 1; max = -1; ps->p++; }
+        else if (*ps->p == '?') { min = 0; max = 1;  ps->p++; }
+        else if (*ps->p != '{' || !parse_count(ps, &min, &max)) break;
+        if (ps->err) break;
+        x = new_node(ps, N_REP, x, -1);
+        ps->n[x].min = min;
+        ps->n[x].max = max;
+        if (*ps->p == '?') { ps->n[x].greedy = false; ps->p++; }
+    }
+    return x;
+}
+
+static int parse_cat(Parser *ps) {
+    int x = -1;
+    while (*ps->p && *ps->p != '|' && *ps->p != ')' && !ps->err) {
+        int y = parse_rep(ps);
+        x = x < 0 ? y : new_node(ps, N_CAT, x, y);
+    }
+    return x < 0 ? new_node(ps, N_EMPTY, -1, -1) : x;
+}
+
+static int parse_alt(Parser *ps) {
+    int x = parse_cat(ps);
+    while (*ps->p == '|' && !ps->err) {
+        ps->p++;
+        x = new_node(ps, N_ALT, x, parse_cat(ps));
+    }
+    return x;
+}
+
+/* ─── Compiler ───────────────────────────────────────────────── */
+
+enum { I_SET, I_SPLIT, I_JMP, I_SAVE, I_ASSERT, I_MATCH };
+
+/* SET: y = set; SPLIT: x preferred over y; SAVE: y = slot; ASSERT:
+   y = kind.  x is the next instruction. */
+typedef struct { uint8_t op; int x, y; } Inst;
+
+typedef struct {
+    Inst *in;
+    int   n, cap;
+    int   start;
+} Prog;
+
+static int emit(Prog *pg, int op, int x, int y) {
+    if (pg->n >= RE_MAX_INSTS) return -1;
+    if (pg->n == pg->cap) {
+        pg->cap = pg->cap ? pg->cap * 2 : 64;
+        pg->in = realloc(pg->in, pg->cap * sizeof(Inst));
+    }
+    pg->in[pg->n] = (Inst){ (uint8_t)op, x, y };
+    return pg->n++;
+}
+
+/* Code matching node ni and then continuing at k; -1 when the program
+   grows too large.  rev compiles the reversed pattern, without saves. */
+static int comp(const Parser *ps, Prog *pg, int ni, int k, bool rev) {
+    if (k < 0) return -1;
+    const Node *n = &ps->n[ni];
+    switch (n->type) {
+    case N_EMPTY:
+        return k;
+    case N_SET:
+        return emit(pg, I_SET, k, n->min);
+    case N_ASSERT: {
+        int kind = n->min;
+        if (rev && kind <= A_EOL) kind = kind == A_BOL ? A_EOL : A_BOL;
+        return emit(pg, I_ASSERT, k, kind);
+    }
+    case N_CAT:
+        return rev ? comp(ps, pg, n->b, comp(ps, pg, n->a, k, rev), rev)
+                   : comp(ps, pg, n->a, comp(ps, pg, n->b, k, rev), rev);
+    case N_ALT: {
+        int a = comp(ps, pg, n->a, k, rev);
+        int b = comp(ps, pg, n->b, k, rev);
+        return a < 0 || b < 0 ? -1 : emit(pg, I_SPLIT, a, b);
+    }
+    case N_GROUP: {
+        if (rev || n->min < 0) return comp(ps, pg, n->a, k, rev);
+        int a = comp(ps, pg, n->a, emit(pg, I_SAVE, k, 2 * n->min + 1), rev);
+        return a < 0 ? -1 : emit(pg, I_SAVE, a, 2 * n->min);
+    }
+    case N_REP: {
+        if (n->max < 0) {
+            int l = emit(pg, I_SPLIT, -1, -1);
+            int a = l < 0 ? -1 : comp(ps, pg, n->a, l, rev);
+            if (a < 0) return -1;
+            pg->in[l].x = n->greedy ? a : k;
+            pg->in[l].y = n->greedy ? k : a;
+            k = l;
+        }
+        for (int i = n->min; i < n->max && k >= 0; i++) {
+            int a = comp(ps, pg, n->a, k, rev);
+            k = a < 0 ? -1 : n->greedy ? emit(pg, I_SPLIT, a, k) : emit(pg, I_SPLIT, k, a);
+        }
+        for (int i = 0; i < n->min && k >= 0; i++) k = comp(ps, pg, n->a, k, rev);
+        return k;
+    }
+    }
+    return -1;
+}
+
+/* ─── Lazy DFA ───────────────────────────────────────────────── */
+
+/* A DFA state is the ordered list of NFA instructions the threads are
+   waiting on (SET, ASSERT, MATCH), plus what the byte before looked like
+   for the assertions.  Leftmost-first DFAs drop every thread ranked
+   below a MATCH; longest-match DFAs keep them all, as a sorted set.
+   Transitions are built on first use; a match is reported on the
+   transition out of the position where it ends, once the next byte is
+   known.  Class ncls stands for the end of the text.  States are
+   handled as the offset of their row in tr, to save a multiply per
+   byte. */
+
+enum { F_NL = 1, F_WORD = 2 };     /* byte before: '\n' or none; word */
+#define DEAD 0
+
+typedef struct { uint32_t off, n, hash; uint8_t flags; } DState;
+
+typedef struct Dfa {
+    const Prog    *pg;
+    const ByteSet *sets;
+    const uint8_t *cls;
+    const int     *rep;
+    int            ncls;
+    bool           longest;
+    int            loop;            /* SET of the .* prefix, or -1 */
+    const char    *lit;             /* literal every match starts with */
+    size_t         nlit;
+
+    DState  *st;   int nst, stcap;
+    int     *ids;  size_t nids, idcap;
+    int32_t *tr;                    /* nst rows of ncls+1: (row<<1)|match */
+    int     *ht;   size_t htcap;
+    int      start[2][4];           /* [prefixed][flags] */
+    size_t   mem;
+    bool     flushed;
+    unsigned flushes;               /* renumberings, for held state numbers */
+
+    int      *stack, *stack2, *list;
+    uint32_t *seen, *seen2, gen;
+} Dfa;
+
+static bool sat(int kind, int flags, int next) {
+    switch (kind) {
+    case A_BOL:   return flags & F_NL;
+    case A_EOL:   return next < 0 || next == '\n';
+    case A_WORDB: return !!(flags & F_WORD) != is_word(next);
+    default:      return !!(flags & F_WORD) == is_word(next);
+    }
+}
+
+static int byte_flags(int b) {
+    return (b < 0 || b == '\n' ? F_NL : 0) | (is_word(b) ? F_WORD : 0);
+}
+
+static void dfa_reset(Dfa *d) {
+    d->nst = 0; d->nids = 0; d->mem = 0;
+    memset(d->ht, -1, d->htcap * sizeof(int));
+    memset(d->start, -1, sizeof d->start);
+}
+
+static uint32_t hash_list(const int *ids, size_t n, int flags) {
+    uint32_t h = 2166136261u ^ (uint32_t)flags;
+    for (size_t i = 0; i < n; i++) h = (h ^ (uint32_t)ids[i]) * 16777619u;
+    return h;
+}
+
+static int cmp_int(const void *a, const void *b) {
+    return (*(const int *)a > *(const int *)b) - (*(const int *)a < *(const int *)b);
+}
+
+/* Index of the state for ids[0..n) after a byte with the given flags */
+static int dfa_intern(Dfa *d, int *ids, size_t n, int flags) {
+    bool asserts = false;
+    for (size_t i = 0; i < n; i++) asserts |= d->pg->in[ids[i]].op == I_ASSERT;
+    if (!asserts) flags = 0;        /* the byte before can't matter */
+    if (d->longest && n) qsort(ids, n, sizeof *ids, cmp_int);
+
+    uint32_t h = hash_list(ids, n, flags);
+    size_t mask = d->htcap - 1;
+    for (size_t i = h & mask; d->ht[i] >= 0; i = (i + 1) & mask) {
+        const DState *s = &d->st[d->ht[i]];
+        if (s->hash == h && s->n == n && s->flags == flags &&
+            !memcmp(d->ids + s->off, ids, n * sizeof *ids))
+            return d->ht[i];
+    }
+
+    size_t row = (size_t)(d->ncls + 1);
+    if (d->mem > RE_DFA_MEM) {
+        /* Start over; the caller's state is gone, only this one is kept */
+        dfa_reset(d);
+        d->flushed = true;
+        d->flushes++;
+        if (n) dfa_intern(d, NULL, 0, 0);
+    }
+    if (d->nst == d->stcap) {
+        d->stcap = d->stcap ? d->stcap * 2 : 64;
+        d->st = realloc(d->st, d->stcap * sizeof(DState));
+        d->tr = realloc(d->tr, d->stcap * row * sizeof(int32_t));
+    }
+    if (d->nids + n > d->idcap) {
+        while (d->nids + n > d->idcap) d->idcap = d->idcap ? d->idcap * 2 : 256;
+        d->ids = realloc(d->ids, d->idcap * sizeof(int));
+    }
+    if (2 * (size_t)(d->nst + 1) > d->htcap) {
+        d->htcap *= 2;
+        d->ht = realloc(d->ht, d->htcap * sizeof(int));
+        memset(d->ht, -1, d->htcap * sizeof(int));
+        for (int s = 0; s < d->nst; s++) {
+            size_t i = d->st[s].hash & (d->htcap - 1);
+            while (d->ht[i] >= 0) i = (i + 1) & (d->htcap - 1);
+            d->ht[i] = s;
+        }
+    }
+    int s = d->nst++;
+    if (n) memcpy(d->ids + d->nids, ids, n * sizeof *ids);
+    d->st[s] = (DState){ (uint32_t)d->nids, (uint32_t)n, h, (uint8_t)flags };
+    d->nids += n;
+    memset(d->tr + (size_t)s * row, -1, row * sizeof(int32_t));
+    size_t i = h & (d->htcap - 1);
+    while (d->ht[i] >= 0) i = (i + 1) & (d->htcap - 1);
+    d->ht[i] = s;
+    d->mem += sizeof(DState) + n * sizeof(int) + row * sizeof(int32_t) + 2 * sizeof(int);
+    return s;
+}
+
+/* Follow the empty moves from pc, appending the instructions threads
+   wait on to list[n..]; *cut once a MATCH is in a leftmost-first list. */
+static size_t dfa_closure(Dfa *d, int pc, size_t n, bool *cut) {
+    const Inst *in = d->pg->in;
+    int sp = 0;
+    d->stack2[sp++] = pc;
+    while (sp && !*cut) {
+        pc = d->stack2[--sp];
+        if (d->seen2[pc] == d->gen) continue;
+        d->seen2[pc] = d->gen;
+        switch (in[pc].op) {
+        case I_SPLIT: d->stack2[sp++] = in[pc].y; d->stack2[sp++] = in[pc].x; break;
+        case I_JMP: case I_SAVE: d->stack2[sp++] = in[pc].x; break;
+        case I_MATCH: d->list[n++] = pc; *cut = !d->longest; break;
+        default: d->list[n++] = pc; break;
+        }
+    }
+    return n;
+}
+
+static void dfa_gen(Dfa *d) {
+    if (++d->gen == 0) {
+        memset(d->seen,  0, d->pg->n * sizeof(uint32_t));
+        memset(d->seen2, 0, d->pg->n * sizeof(uint32_t));
+        d->gen = 1;
+    }
+}
+
+static int dfa_start(Dfa *d, bool prefixed, int flags) {
+    int *s = &d->start[prefixed && d->loop >= 0][flags];
+    if (*s < 0) {
+        bool cut = false;
+        dfa_gen(d);
+        int pc = d->pg->start;
+        if (prefixed && d->loop >= 0) pc = d->pg->in[d->loop].x;
+        size_t n = dfa_closure(d, pc, 0, &cut);
+        d->flushed = false;
+        int st = dfa_intern(d, d->list, n, flags);
+        s = &d->start[prefixed && d->loop >= 0][flags];
+        *s = st;
+    }
+    return *s * (d->ncls + 1);
+}
+
+/* The transition out of the state at row s on byte class c, computed
+   and cached */
+static int32_t dfa_step(Dfa *d, int s, int c) {
+    const Inst *in = d->pg->in;
+    int row = d->ncls + 1;
+    s /= row;
+    DState cur = d->st[s];
+    int next = c < d->ncls ? d->rep[c] : -1;
+    bool matched = false, cut = false;
+    size_t n = 0;
+    dfa_gen(d);
+    for (uint32_t i = 0; i < cur.n && !cut; i++) {
+        int sp = 0;
+        d->stack[sp++] = d->ids[cur.off + i];
+        while (sp && !cut) {
+            int pc = d->stack[--sp];
+            if (d->seen[pc] == d->gen) continue;
+            d->seen[pc] = d->gen;
+            switch (in[pc].op) {
+            case I_SPLIT: d->stack[sp++] = in[pc].y; d->stack[sp++] = in[pc].x; break;
+            case I_JMP: case I_SAVE: d->stack[sp++] = in[pc].x; break;
+            case I_ASSERT:
+                if (sat(in[pc].y, cur.flags, next)) d->stack[sp++] = in[pc].x;
+                break;
+            case I_MATCH:
+                matched = true;
+                cut = !d->longest;
+                break;
+            case I_SET:
+                if (next >= 0 && set_has(&d->sets[in[pc].y], next))
+                    n = dfa_closure(d, in[pc].x, n, &cut);
+                break;
+            }
+        }
+    }
+    if (c == d->ncls) n = 0;
+    d->flushed = false;
+    int ns = n ? dfa_intern(d, d->list, n, byte_flags(next)) : DEAD;
+    int32_t t = (int32_t)(ns * row << 1 | matched);
+    if (!d->flushed) d->tr[(size_t)s * row + c] = t;
+    return t;
+}
+
+/* s without the .* prefix: no new match may start from here on */
+static int dfa_unloop(Dfa *d, int s) {
+    DState cur = d->st[s / (d->ncls + 1)];
+    size_t n = 0;
+    for (uint32_t i = 0; i < cur.n; i++)
+        if (d->ids[cur.off + i] != d->loop) d->list[n++] = d->ids[cur.off + i];
+    return n ? dfa_intern(d, d->list, n, cur.flags) * (d->ncls + 1) : DEAD;
+}
+
+static inline int32_t dfa_next(Dfa *d, int s, int c) {
+    int32_t t = d->tr[s + c];
+    return t >= 0 ? t : dfa_step(d, s, c);
+}
+
+/* ─── Input ──────────────────────────────────────────────────── */
+
+/* A gap buffer, or plain memory when g is NULL */
+typedef struct {
+    const GapBuf *g;
+    const char   *text;
+    size_t        len;
+} ReIn;
+
+static int in_at(const ReIn *in, size_t i) {
+    if (i >= in->len) return -1;
+    return (unsigned char)(in->g ? gb_at(in->g, i) : in->text[i]);
+}
+
+static size_t in_chunk(const ReIn *in, size_t pos, const char **p) {
+    if (in->g) return gb_chunk(in->g, pos, p);
+    *p = in->text + pos;
+    return in->len - pos;
+}
+
+/* Up to sizeof buf bytes ending at pos, not before lo */
+static size_t in_chunk_back(const ReIn *in, size_t pos, size_t lo,
+                            const char **p, char *buf, size_t cap) {
+    if (!in->g) { *p = in->text + lo; return pos - lo; }
+    size_t n = min_sz(pos - lo, cap);
+    gb_get_range(in->g, pos - n, n, buf);
+    *p = buf;
+    return n;
+}
+
+/* ─── Search ─────────────────────────────────────────────────── */
+
+struct Regex {
+    Prog     fwd, rev;
+    ByteSet *sets;
+    uint8_t  cls[256];
+    int      rep[256];
+    int      ncls;
+    int      groups;
+    char     lit[64];
+    size_t   nlit;
+    Dfa      dfwd, drev;
+};
+
+static void dfa_init(Dfa *d, const Prog *pg, const Regex *re, bool longest, int loop) {
+    memset(d, 0, sizeof *d);
+    d->pg = pg; d->sets = re->sets; d->cls = re->cls; d->rep = re->rep;
+    d->ncls = re->ncls; d->longest = longest; d->loop = loop;
+    d->htcap = 256;
+    d->ht     = malloc(d->htcap * sizeof(int));
+    d->stack  = malloc((2 * (size_t)pg->n + 2) * sizeof(int));
+    d->stack2 = malloc((2 * (size_t)pg->n + 2) * sizeof(int));
+    d->list   = malloc(((size_t)pg->n + 1) * sizeof(int));
+    d->seen   = calloc((size_t)pg->n, sizeof(uint32_t));
+    d->seen2  = calloc((size_t)pg->n, sizeof(uint32_t));
+    dfa_reset(d);
+    dfa_intern(d, NULL, 0, 0);      /* DEAD */
+}
+
+static void dfa_free(Dfa *d) {
+    free(d->st); free(d->ids); free(d->tr); free(d->ht);
+    free(d->stack); free(d->stack2); free(d->list);
+    free(d->seen); free(d->seen2);
+}
+
+/* Split the bytes into classes no set tells apart ('\n' and the word
+   bytes included, for the assertions) */
+static void make_classes(Regex *re, int nsets) {
+    ByteSet extra[2] = {{{0}}};
+    set_add(&extra[0], '\n');
+    for (int b = 0; b < 256; b++) if (is_word(b)) set_add(&extra[1], b);
+
+    memset(re->cls, 0, sizeof re->cls);
+    re->ncls = 1;
+    for (int k = 0; k < nsets + 2; k++) {
+        const ByteSet *s = k < nsets ? &re->sets[k] : &extra[k - nsets];
+        int map[256][2];
+        memset(map, -1, sizeof map);
+        int n = 0;
+        for (int b = 0; b < 256; b++) {
+            int *m = &map[re->cls[b]][set_has(s, b)];
+            if (*m < 0) *m = n++;
+            re->cls[b] = (uint8_t)*m;
+        }
+        re->ncls = n;
+    }
+    for (int b = 255; b >= 0; b--) re->rep[re->cls[b]] = b;
+}
+
+/* The bytes every match must start with: single-byte sets on the one
+   path out of the start */
+static size_t lit_prefix(const Prog *pg, const ByteSet *sets, char *out, size_t cap) {
+    size_t n = 0;
+    for (int pc = pg->start; n < cap; pc = pg->in[pc].x) {
+        while (pg->in[pc].op == I_SAVE || pg->in[pc].op == I_JMP) pc = pg->in[pc].x;
+        if (pg->in[pc].op != I_SET) break;
+        int b = -1, k = 0;
+        for (int c = 0; c < 256 && k < 2; c++)
+            if (set_has(&sets[pg->in[pc].y], c)) { b = c; k++; }
+        if (k != 1) break;
+        out[n++] = (char)b;
+    }
+    return n;
+}
+
+Regex *re_compile(const char *pat, const char **err) {
+    Parser ps = { .p = pat };
+    int root = parse_alt(&ps);
+    if (!ps.err && *ps.p) ps.err = "unmatched )";
+    if (ps.err) {
+        *err = ps.err;
+        free(ps.n); free(ps.sets);
+        return NULL;
+    }
+
+    Regex *re = calloc(1, sizeof *re);
+    re->groups = ps.groups;
+    /* The whole match is group 0 */
+    int top = new_node(&ps, N_GROUP, root, -1);
+    ps.n[top].min = 0;
+    int any = new_set(&ps);
+    memset(&ps.sets[any], 0xff, sizeof(ByteSet));
+
+    /* Forward: (?s:.)*?(pattern), the prefix entered at loop's SPLIT */
+    int m = emit(&re->fwd, I_MATCH, 0, 0);
+    re->fwd.start = comp(&ps, &re->fwd, top, m, false);
+    int split = emit(&re->fwd, I_SPLIT, re->fwd.start, -1);
+    int loop  = emit(&re->fwd, I_SET, split, any);
+    if (split >= 0 && loop >= 0) re->fwd.in[split].y = loop;
+    m = emit(&re->rev, I_MATCH, 0, 0);
+    re->rev.start = comp(&ps, &re->rev, root, m, true);
+
+    re->sets = ps.sets;
+    free(ps.n);
+    if (re->fwd.start < 0 || loop < 0 || re->rev.start < 0) {
+        *err = "pattern too large";
+        re_free(re);
+        return NULL;
+    }
+    make_classes(re, ps.nsets);
+    re->nlit = lit_prefix(&re->fwd, re->sets, re->lit, sizeof re->lit);
+    /* dfa_start enters the prefix through the SET's SPLIT */
+    dfa_init(&re->dfwd, &re->fwd, re, false, loop);
+    re->dfwd.lit  = re->lit;
+    re->dfwd.nlit = re->nlit;
+    dfa_init(&re->drev, &re->rev, re, true, -1);
+    return re;
+}
+
+void re_free(Regex *re) {
+    if (!re) return;
+    if (re->dfwd.pg) dfa_free(&re->dfwd);
+    if (re->drev.pg) dfa_free(&re->drev);
+    free(re->fwd.in); free(re->rev.in); free(re->sets);
+    free(re);
+}
+
+int re_groups(const Regex *re) { return re->groups; }
+
+/* End of the leftmost-first match starting in [from, limit) */
+static bool dfa_fwd(Dfa *d, const ReIn *in, size_t from, size_t limit, size_t *end) {
+    /* While no thread is under way, skip to the next literal prefix.  A
+       cache flush renumbers the states, so idle is only trusted until
+       the next one. */
+    int idle = d->nlit ? dfa_start(d, true, 0) : -1;
+    unsigned flushes = d->flushes;
+    int s = dfa_start(d, true, byte_flags(from ? in_at(in, from - 1) : -1));
+    bool found = false, prefixed = true;
+    size_t pos = from;
+    for (;;) {
+        if (prefixed && pos >= limit) {
+            prefixed = false;
+            if ((s = dfa_unloop(d, s)) == DEAD) break;
+        }
+        if (pos >= in->len) {
+            if (dfa_next(d, s, d->ncls) & 1) { found = true; *end = in->len; }
+            break;
+        }
+        const char *p;
+        size_t n = in_chunk(in, pos, &p);
+        if (prefixed) n = min_sz(n, limit - pos);
+        for (size_t i = 0; i < n; i++) {
+            if (d->flushes != flushes) idle = -1;
+            if (s == idle && prefixed) {
+                const char *m = memmem(p + i, n - i, d->lit, d->nlit);
+                i = m ? (size_t)(m - p) : n - min_sz(n - i, d->nlit - 1);
+                if (i >= n) break;
+            }
+            int32_t t = dfa_next(d, s, d->cls[(unsigned char)p[i]]);
+            if (t & 1) { found = true; *end = pos + i; }
+            if ((s = t >> 1) == DEAD) return found;
+        }
+        pos += n;
+    }
+    return found;
+}
+
+/* Start of the longest match of the reversed pattern ending at end,
+   scanning back no further than lo */
+static size_t dfa_rev(Dfa *d, const ReIn *in, size_t end, size_t lo) {
+    int s = dfa_start(d, false, byte_flags(in_at(in, end)));
+    size_t start = end, pos = end;
+    char buf[4096];
+    while (pos > lo) {
+        const char *p;
+        size_t n = in_chunk_back(in, pos, lo, &p, buf, sizeof buf);
+        for (size_t i = n; i-- > 0; ) {
+            int32_t t = dfa_next(d, s, d->cls[(unsigned char)p[i]]);
+            if (t & 1) start = pos - n + i + 1;
+            if ((s = t >> 1) == DEAD) return start;
+        }
+        pos -= n;
+    }
+    int before = lo ? in_at(in, lo - 1) : -1;
+    if (dfa_next(d, s, before < 0 ? d->ncls : d->cls[before]) & 1) start = lo;
+    return start;
+}
+
+static bool re_exec(Regex *re, const ReIn *in, size_t from, size_t limit,
+                    size_t *start, size_t *end) {
+    size_t e;
+    if (from > in->len || !dfa_fwd(&re->dfwd, in, from, limit, &e)) return false;
+    *start = dfa_rev(&re->drev, in, e, from);
+    *end   = e;
+    return true;
+}
+
+/* Leftmost-first match starting in [from, limit) of g: true and its
+   bounds, or false. */
+bool re_search(Regex *re, const GapBuf *g, size_t from, size_t limit,
+               size_t *start, size_t *end) {
+    ReIn in = { g, NULL, gb_len(g) };
+    return re_exec(re, &in, from, limit, start, end);
+}
+
+bool re_search_in(Regex *re, const char *text, size_t len, size_t from,
+                  size_t *start, size_t *end) {
+    ReIn in = { NULL, text, len };
+    return re_exec(re, &in, from, len + 1, start, end);
+}
+
+/* ─── Captures ───────────────────────────────────────────────── */
+
+/* Pike VM: threads in priority order, each with its own capture slots */
+typedef struct {
+    int    *dense, *sparse, n;
+    size_t *caps;               /* slots per thread, by position in dense */
+} Threads;
+
+typedef struct {
+    const Prog *pg;
+    int ns;                     /* capture slots */
+} Pike;
+
+static void pike_add(const Pike *vm, Threads *l, int pc, size_t *cap,
+                     int flags, int next, size_t pos) {
+    if (l->sparse[pc] < l->n && l->dense[l->sparse[pc]] == pc) return;
+    int k = l->n++;
+    l->sparse[pc] = k;
+    l->dense[k] = pc;
+    const Inst *in = &vm->pg->in[pc];
+    switch (in->op) {
+    case I_JMP:
+        pike_add(vm, l, in->x, cap, flags, next, pos);
+        break;
+    case I_SPLIT:
+        pike_add(vm, l, in->x, cap, flags, next, pos);
+        pike_add(vm, l, in->y, cap, flags, next, pos);
+        break;
+    case I_SAVE: {
+        size_t old = cap[in->y];
+        cap[in->y] = pos;
+        pike_add(vm, l, in->x, cap, flags, next, pos);
+        cap[in->y] = old;
+        break;
+    }
+    case I_ASSERT:
+        if (sat(in->y, flags, next)) pike_add(vm, l, in->x, cap, flags, next, pos);
+        break;
+    default:
+        memcpy(l->caps + (size_t)k * vm->ns, cap, vm->ns * sizeof(size_t));
+        break;
+    }
+}
+
+/* Group bounds of the match [start, end) found by re_search:
+   caps[2i], caps[2i+1] for groups 0..re_groups(), SIZE_MAX where a group
+   took no part. */
+bool re_captures(Regex *re, const GapBuf *g, size_t start, size_t end, size_t *caps) {
+    ReIn in = { g, NULL, gb_len(g) };
+    Pike vm = { &re->fwd, 2 * (re->groups + 1) };
+    size_t n = (size_t)re->fwd.n;
+    Threads t[2];
+    for (int i = 0; i < 2; i++) {
+        t[i].dense  = malloc(n * sizeof(int));
+        t[i].sparse = calloc(n, sizeof(int));
+        t[i].caps   = malloc(n * vm.ns * sizeof(size_t));
+        t[i].n = 0;
+    }
+    size_t *cap = malloc(vm.ns * sizeof(size_t));
+    for (int i = 0; i < vm.ns; i++) cap[i] = SIZE_MAX;
+
+    bool found = false;
+    Threads *cl = &t[0], *nl = &t[1];
+    int prev = start ? in_at(&in, start - 1) : -1, cur = in_at(&in, start);
+    pike_add(&vm, cl, re->fwd.start, cap, byte_flags(prev), cur, start);
+    for (size_t pos = start; cl->n; pos++) {
+        int next = in_at(&in, pos + 1);
+        nl->n = 0;
+        for (int i = 0; i < cl->n; i++) {
+            const Inst *ip = &re->fwd.in[cl->dense[i]];
+            size_t *tc = cl->caps + (size_t)i * vm.ns;
+            if (ip->op == I_MATCH) {
+                if (pos == end) {
+                    memcpy(caps, tc, vm.ns * sizeof(size_t));
+                    found = true;
+                }
+                break;
+            }
+            if (ip->op == I_SET && pos < end && set_has(&re->sets[ip->y], cur))
+                pike_add(&vm, nl, ip->x, tc, byte_flags(cur), next, pos + 1);
+        }
+        if (pos >= end) break;
+        Threads *tmp = cl; cl = nl; nl = tmp;
+        cur = next;
+    }
+    for (int i = 0; i < 2; i++) { free(t[i].dense); free(t[i].sparse); free(t[i].caps); }
+    free(cap);
+    return found;
+}
@@ -1,6 +1,20 @@
 #include "abyss.h"
 #include <string.h>
 
+#define SEARCH_CHUNK  (4u << 20)  /* bytes scanned per search_step */
+#define SEARCH_REFINE 65536      /* old matches refined per search_step */
+#define SEARCH_RE_CHUNK (256u << 10) /* bytes per step in regex mode */
+#define SEARCH_PAR_MIN   (32u << 20) /* buffers from this size use workers */
+#define SEARCH_PAR_PART  (8u << 20)  /* bytes per part handed to a worker */
+#define SEARCH_MAX_THREADS 64
+
+/* ─── Kernels ────────────────────────────────────────────────── */
+
+/* Kernels return the start of the first match of pat in t[0..n), or n.
+   skip is the BMH table; the vector kernels don't need it. */
+typedef size_t (*FindFn)(const char *t, size_t n, const char *pat,
+                         size_t plen, const int *skip);
+
 /* Simple Boyer-Moore-Horspool for text search */
 static void bmh_build(const char *pat, int plen, int *skip) {
     for (int i = 0; i < 256; i++) skip[i] = plen;
@@ -8,44 +22,488 @@ static void bmh_build(const char *pat, int plen, int *skip) {
         skip[(unsigned char)pat[i]] = plen - 1 - i;
 }
 
-void search_find(SearchCtx *sc, const GapBuf *g) {
-    sc->count = 0;
-    sc->current = -1;
-    if (!sc->query[0]) return;
+static size_t find_bmh(const char *t, size_t n, const char *pat,
+                       size_t plen, const int *skip) {
+    size_t i = plen - 1;
+    while (i < n) {
+        size_t j = plen - 1, k = i;
+        while (t[k] == pat[j]) {
+            if (j == 0) return k;
+            j--; k--;
+        }
+        i += skip[(unsigned char)t[i]];
+    }
+    return n;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+/* First and last pattern bytes are compared at 16/32 positions at once;
+   candidates where both agree are verified with memcmp. */
+__attribute__((target("sse2")))
+static size_t find_sse2(const char *t, size_t n, const char *pat,
+                        size_t plen, const int *skip) {
+    const __m128i first = _mm_set1_epi8(pat[0]);
+    const __m128i last  = _mm_set1_epi8(pat[plen - 1]);
+    size_t i = 0;
+    for (; i + plen - 1 + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(t + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(t + i + plen - 1));
+        unsigned m = (unsigned)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        while (m) {
+            size_t k = i + __builtin_ctz(m);
+            if (plen <= 2 || !memcmp(t + k + 1, pat + 1, plen - 2)) return k;
+            m &= m - 1;
+        }
+    }
+    return i + find_bmh(t + i, n - i, pat, plen, skip);
+}
+
+__attribute__((target("avx2")))
+static size_t find_avx2(const char *t, size_t n, const char *pat,
+                        size_t plen, const int *skip) {
+    const __m256i first = _mm256_set1_epi8(pat[0]);
+    const __m256i last  = _mm256_set1_epi8(pat[plen - 1]);
+    size_t i = 0;
+    for (; i + plen - 1 + 32 <= n; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(t + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(t + i + plen - 1));
+        unsigned m = (unsigned)_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+        while (m) {
+            size_t k = i + __builtin_ctz(m);
+            if (plen <= 2 || !memcmp(t + k + 1, pat + 1, plen - 2)) return k;
+            m &= m - 1;
+        }
+    }
+    return i + find_sse2(t + i, n - i, pat, plen, skip);
+}
+#endif
+
+static const struct { const char *name; FindFn fn; } find_kernels[] = {
+#if defined(__x86_64__) || defined(__i386__)
+    { "avx2", find_avx2 },
+    { "sse2", find_sse2 },
+#endif
+    { "bmh",  find_bmh  },
+};
+
+static FindFn find_fn;
+
+static bool find_kernel_ok(const char *name) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (!strcmp(name, "avx2")) return __builtin_cpu_supports("avx2");
+    if (!strcmp(name, "sse2")) return __builtin_cpu_supports("sse2");
+#endif
+    return true;
+}
+
+/* Select the search kernel by name, or the best one the CPU supports
+   when name is NULL.  Returns the name of the kernel in use. */
+const char *search_set_kernel(const char *name) {
+    size_t n = sizeof find_kernels / sizeof find_kernels[0];
+    for (size_t i = 0; i < n; i++) {
+        if (name && strcmp(name, find_kernels[i].name)) continue;
+        if (!find_kernel_ok(find_kernels[i].name)) continue;
+        find_fn = find_kernels[i].fn;
+        return find_kernels[i].name;
+    }
+    return name ? search_set_kernel(NULL) : NULL;
+}
 
-    int plen = (int)strlen(sc->query);
-    size_t tlen = gb_len(g);
-    if ((size_t)plen > tlen) return;
+/* ─── Search ─────────────────────────────────────────────────── */
 
-    /* Materialise buffer for BMH */
-    char *text = gb_to_str(g);
+static void push_match(SearchCtx *sc, size_t pos) {
+    if (sc->count >= sc->cap) {
+        sc->cap = sc->cap ? sc->cap * 2 : 64;
+        sc->matches = realloc(sc->matches, sc->cap * sizeof(size_t));
+    }
+    sc->matches[sc->count++] = pos;
+}
 
+/* Every match in text[0..len), which sits at offset base in the buffer.
+   Only matches starting before limit (a buffer offset) are taken; *next
+   is the earliest start still allowed (matches don't overlap unless
+   sc->overlap). */
+static void seg_scan(SearchCtx *sc, const char *pat, size_t plen, const int *skip,
+                     const char *text, size_t len, size_t base, size_t limit,
+                     size_t *next) {
+    size_t step = sc->overlap ? 1 : plen;
+    size_t i = *next > base ? *next - base : 0;
+    while (base + i < limit && i + plen <= len) {
+        size_t m = i + find_fn(text + i, len - i, pat, plen, skip);
+        if (base + m >= limit || m + plen > len) break;
+        push_match(sc, base + m);
+        *next = base + m + step;
+        i = m + step;
+    }
+}
+
+/* Matches starting in [a, limit), reading g[a, b) with b = limit+plen-1
+   (or the end of the buffer).  The segments are scanned in place; a
+   match straddling a segment boundary is found in a window stitching the
+   last plen-1 bytes seen to the head of the next segment, so memory
+   stays O(pattern). */
+static void scan_range(SearchCtx *sc, const GapBuf *g, size_t a, size_t b,
+                       size_t limit) {
+    const char *pat = sc->query;
+    size_t plen = strlen(pat);
     int skip[256];
-    bmh_build(sc->query, plen, skip);
+    bmh_build(pat, (int)plen, skip);
 
-    size_t i = plen - 1;
-    while (i < tlen) {
-        int j = plen - 1;
-        size_t k = i;
-        while (j >= 0 && text[k] == sc->query[j]) { j--; k--; }
-        if (j < 0) {
-            /* match at k+1 */
-            if (sc->count >= sc->cap) {
-                sc->cap = sc->cap ? sc->cap * 2 : 64;
-                sc->matches = realloc(sc->matches, sc->cap * sizeof(size_t));
-            }
-            sc->matches[sc->count++] = k + 1;
-            i += plen;
+    char tail[sizeof sc->query], win[2 * sizeof sc->query];
+    size_t tn = 0, pos = a, n;
+    const char *seg;
+    GbIter it;
+    gb_iter(&it, g, a, b);
+    while ((n = gb_iter_next(&it, &seg))) {
+        if (tn) {
+            size_t head = min_sz(n, plen - 1);
+            memcpy(win, tail, tn);
+            memcpy(win + tn, seg, head);
+            seg_scan(sc, pat, plen, skip, win, tn + head, pos - tn,
+                     min_sz(pos, limit), &sc->next);
+        }
+        seg_scan(sc, pat, plen, skip, seg, n, pos, limit, &sc->next);
+        pos += n;
+
+        /* Keep the last plen-1 bytes for the next boundary */
+        if (n >= plen - 1) {
+            tn = plen - 1;
+            memcpy(tail, seg + n - tn, tn);
         } else {
-            i += skip[(unsigned char)text[i]];
+            size_t keep = min_sz(tn, plen - 1 - n);
+            memmove(tail, tail + tn - keep, keep);
+            memcpy(tail + keep, seg, n);
+            tn = keep + n;
+        }
+    }
+}
+
+/* Matches starting in [from, limit), at or after sc->next.  A regex
+   match may be empty, so limit may be len+1 to take one at the end. */
+static void scan_to(SearchCtx *sc, const GapBuf *g, size_t from, size_t limit) {
+    size_t len = gb_len(g);
+    if (sc->re) {
+        size_t at = max_sz(from, sc->next), s, e;
+        while (at < limit && re_search(sc->re, g, at, limit, &s, &e)) {
+            push_match(sc, s);
+            sc->next = at = e > s ? e : s + 1;
         }
+    } else {
+        size_t plen = strlen(sc->query);
+        if (plen <= len && from < len)
+            scan_range(sc, g, from, min_sz(len, limit + plen - 1), limit);
+    }
+}
+
+/* Where the scan resumes after the match starting at s */
+static size_t match_resume(SearchCtx *sc, const GapBuf *g, size_t s) {
+    if (sc->overlap) return s + 1;
+    if (!sc->re) return s + strlen(sc->query);
+    size_t ms, me;
+    if (!re_search(sc->re, g, s, s + 1, &ms, &me)) return s + 1;
+    return me > ms ? me : ms + 1;
+}
+
+/* ─── Parallel search ────────────────────────────────────────── */
+/* A buffer of SEARCH_PAR_MIN bytes or more is cut into parts that a pool
+   of workers scans in place, each part reading on past its end for the
+   matches that start in it.  search_step merges the finished parts in
+   order, so matches stay sorted and a prefix of them shows up early.
+   A part is scanned as if nothing matched before it; where a match of
+   the previous part runs into it, the few bytes in between are searched
+   again in order (see par_merge).  The buffer is read while the workers
+   run: search_cancel must come before any change to it. */
+
+typedef struct {
+    size_t  a, b;          /* matches starting in [a, b) */
+    size_t *m;             /* their starts, sorted */
+    size_t  n;
+    bool    done;
+} SearchPart;
+
+struct SearchJob {
+    const GapBuf    *g;
+    SearchCtx        proto;     /* query and mode for the workers */
+    SearchPart      *parts;
+    size_t           nparts;
+    size_t           claim;     /* next part to take */
+    size_t           merged;    /* parts merged into the SearchCtx */
+    bool             cancel;
+    pthread_t        threads[SEARCH_MAX_THREADS];
+    int              nthreads;
+    pthread_mutex_t  mu;
+    pthread_cond_t   part_done;
+};
+
+static int par_threads;
+
+/* Number of search workers, or the number of online CPUs when n <= 0.
+   One turns parallel search off.  Returns the count in use. */
+int search_set_threads(int n) {
+    if (n <= 0) n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1) n = 1;
+    if (n > SEARCH_MAX_THREADS) n = SEARCH_MAX_THREADS;
+    return par_threads = n;
+}
+
+static void *par_worker(void *arg) {
+    SearchJob *j = arg;
+    SearchCtx w = j->proto;
+    w.matches = NULL;
+    w.cap = 0;
+    if (w.regex) w.re = re_compile(w.query, &w.err);   /* own DFA cache */
+    size_t len = gb_len(j->g), step = w.re ? SEARCH_RE_CHUNK : SEARCH_CHUNK, i;
+    while ((i = __atomic_fetch_add(&j->claim, 1, __ATOMIC_RELAXED)) < j->nparts) {
+        SearchPart *pt = &j->parts[i];
+        w.count = 0;
+        w.next  = pt->a;
+        for (size_t p = pt->a; p < pt->b; p += step) {
+            if (__atomic_load_n(&j->cancel, __ATOMIC_RELAXED)) goto out;
+            size_t lim = min_sz(p + step, pt->b);
+            scan_to(&w, j->g, p, w.re && lim == len ? len + 1 : lim);
+        }
+        pthread_mutex_lock(&j->mu);
+        pt->m = w.matches;
+        pt->n = w.count;
+        pt->done = true;
+        pthread_cond_signal(&j->part_done);
+        pthread_mutex_unlock(&j->mu);
+        w.matches = NULL;
+        w.cap = 0;
+    }
+out:
+    free(w.matches);
+    re_free(w.re);
+    return NULL;
+}
+
+static bool par_start(SearchCtx *sc, const GapBuf *g) {
+    if (!par_threads) search_set_threads(0);
+    size_t len = gb_len(g);
+    if (par_threads < 2 || len < SEARCH_PAR_MIN) return false;
+    SearchJob *j = calloc(1, sizeof *j);
+    j->g = g;
+    j->proto = *sc;
+    j->proto.re = NULL;
+    j->nparts = (len + SEARCH_PAR_PART - 1) / SEARCH_PAR_PART;
+    j->parts  = calloc(j->nparts, sizeof *j->parts);
+    for (size_t i = 0; i < j->nparts; i++) {
+        j->parts[i].a = i * SEARCH_PAR_PART;
+        j->parts[i].b = min_sz(len, (i + 1) * SEARCH_PAR_PART);
+    }
+    pthread_mutex_init(&j->mu, NULL);
+    pthread_cond_init(&j->part_done, NULL);
+    int n = (int)min_sz((size_t)par_threads, j->nparts);
+    for (int t = 0; t < n; t++)
+        if (pthread_create(&j->threads[j->nthreads], NULL, par_worker, j) == 0)
+            j->nthreads++;
+    if (!j->nthreads) {
+        pthread_mutex_destroy(&j->mu);
+        pthread_cond_destroy(&j->part_done);
+        free(j->parts);
+        free(j);
+        return false;
+    }
+    sc->job = j;
+    return true;
+}
+
+static void par_free(SearchCtx *sc) {
+    SearchJob *j = sc->job;
+    __atomic_store_n(&j->cancel, true, __ATOMIC_RELAXED);
+    for (int t = 0; t < j->nthreads; t++) pthread_join(j->threads[t], NULL);
+    for (size_t i = 0; i < j->nparts; i++) free(j->parts[i].m);
+    pthread_mutex_destroy(&j->mu);
+    pthread_cond_destroy(&j->part_done);
+    free(j->parts);
+    free(j);
+    sc->job = NULL;
+}
+
+/* Append part pt's matches to sc.  The worker resumed at pt->a, while
+   the matches merged so far say to resume at sc->next.  Dropping the
+   part's matches before sc->next leaves it resuming at r: if r is past
+   sc->next, the matches in [sc->next, r) are found in order here and
+   the check repeats; once r <= sc->next both scans agree. */
+static void par_merge(SearchCtx *sc, const GapBuf *g, const SearchPart *pt) {
+    size_t i = 0, r = pt->a;
+    size_t end = pt->b == gb_len(g) && sc->re ? pt->b + 1 : pt->b;
+    for (;;) {
+        while (i < pt->n && pt->m[i] < sc->next) r = match_resume(sc, g, pt->m[i++]);
+        if (r <= sc->next) break;
+        size_t had = sc->count;
+        scan_to(sc, g, sc->next, min_sz(r, end));
+        if (sc->count == had) {
+            sc->next = max_sz(sc->next, min_sz(r, end));
+            break;
+        }
+    }
+    if (i == pt->n) return;
+    for (; i < pt->n; i++) push_match(sc, pt->m[i]);
+    sc->next = match_resume(sc, g, pt->m[pt->n - 1]);
+}
+
+/* Merge the parts finished in order, waiting a few ms for the next one.
+   Returns false once every part is merged. */
+static bool par_step(SearchCtx *sc, const GapBuf *g) {
+    SearchJob *j = sc->job;
+    pthread_mutex_lock(&j->mu);
+    if (!j->parts[j->merged].done) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += 5000000;
+        if (ts.tv_nsec >= 1000000000) { ts.tv_sec++; ts.tv_nsec -= 1000000000; }
+        pthread_cond_timedwait(&j->part_done, &j->mu, &ts);
+    }
+    size_t ready = j->merged;
+    while (ready < j->nparts && j->parts[ready].done) ready++;
+    pthread_mutex_unlock(&j->mu);
+
+    for (; j->merged < ready; j->merged++) {
+        par_merge(sc, g, &j->parts[j->merged]);
+        sc->pos = j->parts[j->merged].b;
+    }
+    if (j->merged < j->nparts) return true;
+    par_free(sc);
+    return false;
+}
+
+/* Stop a search still in progress; the matches found so far stay. */
+void search_cancel(SearchCtx *sc) {
+    if (sc->job) par_free(sc);
+    sc->ref = sc->todo = 0;
+    sc->pending = false;
+}
+
+/* ─── Incremental search ─────────────────────────────────────── */
+
+/* True when a proper prefix of pat is also a suffix, so that two
+   occurrences can overlap and the non-overlapping matches are not all
+   of them. */
+static bool self_overlaps(const char *pat, size_t plen) {
+    for (size_t k = 1; k < plen; k++)
+        if (!memcmp(pat, pat + k, plen - k)) return true;
+    return false;
+}
+
+/* Begin an incremental search for query; search_step does the work.
+   When query extends the previous one and that one cannot overlap
+   itself, its matches are all the candidates there are: they are
+   refined instead of rescanning the bytes already searched.  In regex
+   mode the query is compiled and the buffer always scanned again. */
+void search_start(SearchCtx *sc, const char *query) {
+    size_t olen = strlen(sc->query), qlen = strlen(query);
+    bool refine = olen && qlen > olen && !strncmp(query, sc->query, olen)
+               && sc->ref == sc->todo && !sc->job && !sc->regex
+               && (sc->overlap || !self_overlaps(sc->query, olen));
+    if (sc->job) par_free(sc);
+    snprintf(sc->query, sizeof sc->query, "%s", query);
+    sc->current = -1;
+    sc->next    = 0;
+    if (refine) {
+        sc->ref   = 0;
+        sc->todo  = sc->count;
+    } else {
+        sc->ref = sc->todo = 0;
+        sc->pos = 0;
+    }
+    sc->count   = 0;
+    sc->pending = qlen > 0;
+    if (sc->regex) {
+        re_free(sc->re);
+        sc->re  = NULL;
+        sc->err = NULL;
+        if (qlen) sc->re = re_compile(query, &sc->err);
+        sc->pending = sc->re != NULL;
+    }
+}
+
+/* One bounded slice of the search started by search_start: first up to
+   SEARCH_REFINE old matches are checked against the query, then up to
+   SEARCH_CHUNK bytes are scanned (SEARCH_RE_CHUNK for a regex, where a
+   match may be empty and may run past the chunk).  A large buffer is
+   handed to the workers instead, and each step merges what they have
+   found.  Returns true while work remains, so the caller can interleave
+   it with input and redraws. */
+bool search_step(SearchCtx *sc, const GapBuf *g) {
+    if (!sc->pending) return false;
+    if (!find_fn) search_set_kernel(NULL);
+    size_t plen = strlen(sc->query), len = gb_len(g);
+
+    if (sc->job) {
+        sc->pending = par_step(sc, g);
+    } else if (sc->ref < sc->todo) {
+        char buf[sizeof sc->query];
+        size_t stop = min_sz(sc->todo, sc->ref + SEARCH_REFINE);
+        for (; sc->ref < stop; sc->ref++) {
+            size_t m = sc->matches[sc->ref];
+            if (m < sc->next || m + plen > len) continue;
+            gb_get_range(g, m, plen, buf);
+            if (memcmp(buf, sc->query, plen)) continue;
+            sc->matches[sc->count++] = m;
+            sc->next = m + (sc->overlap ? 1 : plen);
+        }
+    } else if (sc->pos == 0 && (sc->re || plen <= len) && par_start(sc, g)) {
+        sc->pending = par_step(sc, g);
+    } else if (sc->re && sc->pos <= len) {
+        /* An empty match may start at the very end */
+        size_t limit = sc->pos + min_sz(SEARCH_RE_CHUNK, len - sc->pos);
+        scan_to(sc, g, sc->pos, limit == len ? len + 1 : limit);
+        sc->pos = limit == len ? len + 1 : limit;
+    } else if (!sc->re && sc->pos < len && plen <= len) {
+        size_t limit = sc->pos + min_sz(SEARCH_CHUNK, len - sc->pos);
+        scan_to(sc, g, sc->pos, limit);
+        sc->pos = limit;
+    } else {
+        sc->pos = len;
+        sc->pending = false;
+    }
+    if (sc->count > 0 && sc->current < 0) sc->current = 0;
+    return sc->pending;
+}
+
+/* Search the whole buffer for sc->query in one go */
+void search_find(SearchCtx *sc, const GapBuf *g) {
+    char query[sizeof sc->query];
+    snprintf(query, sizeof query, "%s", sc->query);
+    sc->query[0] = '\0';
+    search_start(sc, query);
+    while (search_step(sc, g)) ;
+}
+
+/* Start of the next match at or after from in text[0..len), or len, and
+   its end in *end.  text is g from base on; a regex match starting in it
+   is found in g itself, so ^ $ \b see the bytes around text and the
+   match may run past len.  pane_render walks these to draw matches over
+   the syntax colours, for the visible lines only. */
+size_t search_next_in(const SearchCtx *sc, const GapBuf *g, size_t base,
+                      const char *text, size_t len, size_t from, size_t *end) {
+    if (sc->regex) {
+        size_t s, e;
+        if (!sc->re || from >= len || !re_search(sc->re, g, base + from, base + len, &s, &e))
+            return *end = len;
+        *end = e - base;
+        return s - base;
     }
-    free(text);
-    if (sc->count > 0) sc->current = 0;
+    size_t qlen = strlen(sc->query);
+    if (!qlen || from >= len || len - from < qlen) return *end = len;
+    const char *m = memmem(text + from, len - from, sc->query, qlen);
+    if (!m) return *end = len;
+    *end = (size_t)(m - text) + qlen;
+    return (size_t)(m - text);
 }
 
 void search_clear(SearchCtx *sc) {
+    search_cancel(sc);
     sc->query[0] = '\0';
     sc->count = 0;
     sc->current = -1;
+    re_free(sc->re);
+    sc->re  = NULL;
+    sc->err = NULL;
 }
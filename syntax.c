@@ -1,6 +1,9 @@
 #include "abyss.h"
 #include <string.h>
 #include <ctype.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 /* ─── Keyword tables ─────────────────────────────────────────── */
 static const char *kw_c[] = {
@@ -73,6 +76,7 @@ static const char *kw_cs[] = {
     "unchecked","unsafe","ushort","using","var","virtual","void",
     "volatile","while",NULL
 };
+static const char *kw_json[] = { "true","false","null",NULL };
 static const char *kw_asm[] = {
     "mov","push","pop","call","ret","jmp","je","jne","jz","jnz",
     "jl","jle","jg","jge","cmp","test","add","sub","mul","div",
@@ -83,12 +87,89 @@ static const char *kw_asm[] = {
     "global","extern","bits","org",NULL
 };
 
-static bool kw_match(const char **table, const char *s, int len) {
-    for (int i = 0; table[i]; i++) {
-        if ((int)strlen(table[i]) == len && memcmp(table[i], s, len) == 0)
-            return true;
+/* ─── Keyword sets ───────────────────────────────────────────── */
+/* Each language gets one perfect hash over its keywords and types: the
+   seed is picked when the set is built so that no two words share a slot,
+   and classifying an identifier costs one hash, one probe and at most one
+   memcmp whatever the size of the list. */
+
+#define KW_MAX    128
+#define KW_BITS   10           /* 1024 slots, ~8x the largest set */
+#define KW_LENMAX 31
+
+typedef struct {
+    const char **kw, **ty;
+    uint32_t     seed;
+    int          shift;
+    int          n;
+    const char  *word[KW_MAX];
+    uint8_t      len[KW_MAX];
+    uint8_t      tok[KW_MAX];
+    uint8_t      slot[1 << KW_BITS];   /* entry + 1, 0 = empty */
+} KwSet;
+
+enum { KS_C, KS_CPP, KS_PY, KS_SH, KS_JS, KS_SQL, KS_CS, KS_ASM, KS_JSON,
+       KS_COUNT };
+
+static KwSet kw_sets[KS_COUNT] = {
+    [KS_C]   = { kw_c,   ty_c   },
+    [KS_CPP] = { kw_cpp, ty_cpp },
+    [KS_PY]  = { kw_py,  ty_py  },
+    [KS_SH]  = { kw_sh,  NULL   },
+    [KS_JS]  = { kw_js,  NULL   },
+    [KS_SQL] = { kw_sql, NULL   },
+    [KS_CS]  = { kw_cs,  NULL   },
+    [KS_ASM] = { kw_asm, NULL   },
+    [KS_JSON]= { kw_json, NULL  },
+};
+static pthread_once_t lex_once = PTHREAD_ONCE_INIT;
+
+static inline uint32_t kw_hash(uint32_t seed, const char *s, int len) {
+    uint32_t h = seed ^ (uint32_t)len;
+    for (int i = 0; i < len; i++) h = (h ^ (unsigned char)s[i]) * 16777619u;
+    return h;
+}
+
+static void kw_add(KwSet *k, const char **list, TokenType tok) {
+    for (int i = 0; list && list[i]; i++) {
+        int len = (int)strlen(list[i]), dup = 0;
+        for (int j = 0; j < k->n && !dup; j++)
+            dup = k->len[j] == len && memcmp(k->word[j], list[i], len) == 0;
+        if (dup || k->n == KW_MAX) continue;     /* first list wins */
+        k->word[k->n] = list[i];
+        k->len[k->n]  = (uint8_t)len;
+        k->tok[k->n]  = (uint8_t)tok;
+        k->n++;
     }
-    return false;
+}
+
+static void kw_build(KwSet *k) {
+    kw_add(k, k->kw, TOK_KEYWORD);
+    kw_add(k, k->ty, TOK_TYPE);
+    k->shift = 32 - KW_BITS;
+    for (k->seed = 2166136261u;; k->seed = k->seed * 747796405u + 2891336453u) {
+        memset(k->slot, 0, sizeof k->slot);
+        int i = 0;
+        for (; i < k->n; i++) {
+            uint8_t *sl = &k->slot[kw_hash(k->seed, k->word[i], k->len[i]) >> k->shift];
+            if (*sl) break;
+            *sl = (uint8_t)(i + 1);
+        }
+        if (i == k->n) return;
+    }
+}
+
+static void kw_init(void) {
+    for (int i = 0; i < KS_COUNT; i++) kw_build(&kw_sets[i]);
+}
+
+static inline TokenType kw_class(int set, const char *s, int len) {
+    const KwSet *k = &kw_sets[set];
+    if (len > KW_LENMAX) return TOK_IDENT;
+    int e = k->slot[kw_hash(k->seed, s, len) >> k->shift] - 1;
+    if (e >= 0 && k->len[e] == len && memcmp(k->word[e], s, len) == 0)
+        return (TokenType)k->tok[e];
+    return TOK_IDENT;
 }
 
 Language lang_from_ext(const char *ext) {
@@ -121,336 +202,1195 @@ Language lang_from_ext(const char *ext) {
     return LANG_NONE;
 }
 
-/* ─── State machine lexer ────────────────────────────────────── */
-
-typedef struct { int state; } LexState;
-
-static void lex_line_c_like(
-    const char *line, int len,
-    LexState *ls, TokenType *out,
-    Language lang, bool is_cpp)
-{
-    const char **kws = is_cpp ? kw_cpp : kw_c;
-    const char **tys = is_cpp ? ty_cpp : ty_c;
-
-    int i = 0;
-    while (i < len) {
-        if (ls->state == 1) {
-            int start = i;
-            while (i < len) {
-                if (i+1 < len && line[i]=='*' && line[i+1]=='/') {
-                    out[i] = out[i+1] = TOK_COMMENT;
-                    i += 2; ls->state = 0; goto cont;
-                }
-                out[i++] = TOK_COMMENT;
-            }
-            (void)start;
-            goto cont;
-        }
-        if (ls->state == 2) {
-            while (i < len) {
-                out[i] = TOK_STRING;
-                if (line[i] == '\\') { i++; if (i<len) out[i++]=TOK_STRING; continue; }
-                if (line[i++] == '"') { ls->state=0; break; }
-            }
-            goto cont;
-        }
-        if (ls->state == 3) {
-            while (i < len) {
-                out[i] = TOK_CHAR;
-                if (line[i] == '\\') { i++; if (i<len) out[i++]=TOK_CHAR; continue; }
-                if (line[i++] == '\'') { ls->state=0; break; }
-            }
-            goto cont;
-        }
+/* ─── DFA lexer ──────────────────────────────────────────────── */
+/* Every language is a transition table over byte classes.  The tables
+   are written below as a few rows per state over byte sets; dfa_compile
+   folds bytes that every state treats alike into one class, so lexing a
+   byte costs a class load and a transition load.
 
-        char c = line[i];
+   The token of a byte is the token of the state it leads to.  A state
+   with back > 0 also repaints the bytes that led into it, like the slash
+   of a comment opener.  Runs of a word state are looked up in the
+   language's keyword set when the run ends.  eol gives the state carried
+   to the next line; state 0 is the start of a line in every language.
 
-        if (c=='/' && i+1<len && line[i+1]=='/') {
-            while (i<len) out[i++]=TOK_COMMENT;
-            goto cont;
-        }
-        if (c=='/' && i+1<len && line[i+1]=='*') {
-            out[i++]=TOK_COMMENT; out[i++]=TOK_COMMENT;
-            ls->state=1;
-            goto cont;
-        }
-        if (c=='#' && i==0) {
-            while (i<len) out[i++]=TOK_PREPROC;
-            goto cont;
-        }
-        if (c=='"') {
-            out[i++]=TOK_STRING; ls->state=2;
-            goto cont;
-        }
-        if (c=='\'') {
-            out[i++]=TOK_CHAR; ls->state=3;
-            goto cont;
-        }
-        if (isdigit((unsigned char)c) ||
-            (c=='0' && i+1<len && (line[i+1]=='x'||line[i+1]=='X'))) {
-            while (i<len && (isalnum((unsigned char)line[i])||line[i]=='.'))
-                out[i++]=TOK_NUMBER;
-            goto cont;
-        }
-        if (isalpha((unsigned char)c)||c=='_') {
-            int start=i;
-            while (i<len && (isalnum((unsigned char)line[i])||line[i]=='_')) i++;
-            int wlen=i-start;
-            TokenType tt=TOK_IDENT;
-            if (kw_match(kws, line+start, wlen)) tt=TOK_KEYWORD;
-            else if (kw_match(tys, line+start, wlen)) tt=TOK_TYPE;
-            for(int j=start;j<i;j++) out[j]=tt;
-            goto cont;
-        }
-        if (strchr("+-*/%=<>!&|^~?:;,.{}[]()@",c))
-            { out[i++]=TOK_OPERATOR; goto cont; }
-
-        out[i++]=TOK_NORMAL;
-        cont:;
-    }
-    (void)lang;
-}
-
-static void lex_line_python(const char *line, int len, LexState *ls, TokenType *out) {
-    int i=0;
-    while (i<len) {
-        if (ls->state==5) {
-            while (i<len) {
-                out[i]=TOK_STRING;
-                if (i+2<len && line[i]=='"'&&line[i+1]=='"'&&line[i+2]=='"') {
-                    out[i+1]=out[i+2]=TOK_STRING; i+=3; ls->state=0; break;
-                }
-                i++;
-            }
-            continue;
-        }
-        if (ls->state==6) {
-            while (i<len) {
-                out[i]=TOK_STRING;
-                if (i+2<len && line[i]=='\''&&line[i+1]=='\''&&line[i+2]=='\'') {
-                    out[i+1]=out[i+2]=TOK_STRING; i+=3; ls->state=0; break;
-                }
-                i++;
-            }
-            continue;
-        }
-        char c=line[i];
-        if (c=='#') { while(i<len) out[i++]=TOK_COMMENT; break; }
-        if (i+2<len && c=='"'&&line[i+1]=='"'&&line[i+2]=='"') {
-            out[i]=out[i+1]=out[i+2]=TOK_STRING; i+=3; ls->state=5; continue;
-        }
-        if (i+2<len && c=='\''&&line[i+1]=='\''&&line[i+2]=='\'') {
-            out[i]=out[i+1]=out[i+2]=TOK_STRING; i+=3; ls->state=6; continue;
-        }
-        if (c=='"'||c=='\'') {
-            char delim=c; out[i++]=TOK_STRING;
-            while (i<len) {
-                out[i]=TOK_STRING;
-                if (line[i]=='\\') { i++; if(i<len) out[i++]=TOK_STRING; continue; }
-                if (line[i++]==delim) break;
-            }
-            continue;
-        }
-        if (isdigit((unsigned char)c)) {
-            while(i<len && (isalnum((unsigned char)line[i])||line[i]=='.')) out[i++]=TOK_NUMBER;
-            continue;
-        }
-        if (isalpha((unsigned char)c)||c=='_') {
-            int start=i;
-            while(i<len&&(isalnum((unsigned char)line[i])||line[i]=='_')) i++;
-            int wl=i-start;
-            TokenType tt=TOK_IDENT;
-            if (kw_match(kw_py, line+start, wl)) tt=TOK_KEYWORD;
-            else if (kw_match(ty_py, line+start, wl)) tt=TOK_TYPE;
-            for(int j=start;j<i;j++) out[j]=tt;
-            continue;
-        }
-        if (strchr("+-*/%=<>!&|^~?:;,.{}[]()@",c)) out[i++]=TOK_OPERATOR;
-        else out[i++]=TOK_NORMAL;
-    }
-}
-
-static void lex_line_sh(const char *line, int len, LexState *ls, TokenType *out) {
-    (void)ls;
-    int i=0;
-    while (i<len) {
-        char c=line[i];
-        if (c=='#') { while(i<len) out[i++]=TOK_COMMENT; break; }
-        if (c=='"'||c=='\'') {
-            char d=c; out[i++]=TOK_STRING;
-            while(i<len) {
-                out[i]=TOK_STRING;
-                if(line[i]=='\\'){i++;if(i<len)out[i++]=TOK_STRING;continue;}
-                if(line[i++]==d) break;
-            }
-            continue;
-        }
-        if (isdigit((unsigned char)c)) { while(i<len&&isdigit((unsigned char)line[i])) out[i++]=TOK_NUMBER; continue; }
-        if (isalpha((unsigned char)c)||c=='_') {
-            int s=i;
-            while(i<len&&(isalnum((unsigned char)line[i])||line[i]=='_'||line[i]=='-')) i++;
-            int wl=i-s;
-            TokenType tt=kw_match(kw_sh,line+s,wl)?TOK_KEYWORD:TOK_IDENT;
-            for(int j=s;j<i;j++) out[j]=tt;
-            continue;
-        }
-        if (c=='$') { out[i++]=TOK_PREPROC; continue; }
-        out[i++]=TOK_NORMAL;
+   States that loop on all but a few bytes (comment and string bodies,
+   HTML text), or on only a few (indentation), are skipped through 16 or
+   32 bytes at a time with SSE2/AVX2 compares. */
+
+#define DFA_STATES  64
+#define DFA_CLASSES 48
+#define DFA_UNSET   0xff
+
+enum { SKIP_NONE, SKIP_UNTIL, SKIP_WHILE };
+
+typedef struct {
+    uint8_t mode, n;
+    uint8_t b[4];
+} DfaSkip;
+
+typedef struct {
+    uint8_t  cls[256];
+    uint8_t  next[DFA_STATES][DFA_CLASSES];
+    uint8_t  tok[DFA_STATES];
+    uint8_t  eol[DFA_STATES];
+    uint8_t  back[DFA_STATES];
+    bool     word[DFA_STATES];
+    DfaSkip  skip[DFA_STATES];
+    int      ks;                /* keyword set of word runs, -1 = none */
+    int      fold;              /* case of the keyword set: 0, 'A' or 'a' */
+} Dfa;
+
+/* Rows being written: t[s][byte], DFA_UNSET falls back to the row of
+   like[s], or to staying in s. */
+typedef struct {
+    uint8_t t[DFA_STATES][256];
+    int     like[DFA_STATES];
+    int     n;
+} DfaBuild;
+
+enum { DFA_C, DFA_PY, DFA_SH, DFA_SQL, DFA_ASM, DFA_JSON, DFA_HTML,
+       DFA_CSS, DFA_NONE, DFA_COUNT };
+
+static Dfa dfa_c, dfa_cpp, dfa_cs, dfa_js, dfa_tab[DFA_COUNT];
+
+#define ALPHA "a-zA-Z_"
+#define ALNUM "a-zA-Z0-9_"
+#define OPS   "-+*/%=<>!&|^~?:;,.{}[]()@"
+
+static void dfa_begin(DfaBuild *b) {
+    memset(b->t, DFA_UNSET, sizeof b->t);
+    for (int s = 0; s < DFA_STATES; s++) b->like[s] = -1;
+    b->n = 0;
+}
+
+static void dfa_state(Dfa *d, DfaBuild *b, int s, TokenType tok, int eol) {
+    d->tok[s] = (uint8_t)tok;
+    d->eol[s] = (uint8_t)eol;
+    if (s >= b->n) b->n = s + 1;
+}
+
+/* from goes to to on the bytes of set ("a-z" is a range). */
+static void dfa_go(DfaBuild *b, int from, const char *set, int to) {
+    const unsigned char *p = (const unsigned char *)set;
+    for (; *p; p++) {
+        unsigned lo = *p, hi = *p;
+        if (p[1] == '-' && p[2] >= lo) { hi = p[2]; p += 2; }
+        for (unsigned c = lo; c <= hi; c++) b->t[from][c] = (uint8_t)to;
     }
 }
 
-static void lex_line_sql(const char *line, int len, LexState *ls, TokenType *out) {
-    (void)ls;
-    int i=0;
-    while(i<len) {
-        char c=line[i];
-        if (c=='-'&&i+1<len&&line[i+1]=='-') { while(i<len) out[i++]=TOK_COMMENT; break; }
-        if (c=='\'') {
-            out[i++]=TOK_STRING;
-            while(i<len) { out[i]=TOK_STRING; if(line[i++]=='\'') break; }
-            continue;
-        }
-        if (isdigit((unsigned char)c)) { while(i<len&&(isdigit((unsigned char)line[i])||line[i]=='.')) out[i++]=TOK_NUMBER; continue; }
-        if (isalpha((unsigned char)c)||c=='_') {
-            int s=i;
-            while(i<len&&(isalnum((unsigned char)line[i])||line[i]=='_')) i++;
-            char tmp[128]={0}; int wl=i-s; if(wl>127)wl=127;
-            for(int j=0;j<wl;j++) tmp[j]=toupper((unsigned char)line[s+j]);
-            TokenType tt=kw_match(kw_sql,tmp,wl)?TOK_KEYWORD:TOK_IDENT;
-            for(int j=s;j<i;j++) out[j]=tt;
-            continue;
-        }
-        out[i++]=TOK_NORMAL;
+static void dfa_all(DfaBuild *b, int from, int to) {
+    memset(b->t[from], to, 256);
+}
+
+static void dfa_like(DfaBuild *b, int s, int model) { b->like[s] = model; }
+
+/* A quoted run entered from ctx on q: body up to the closing q (end),
+   with esc (0 for none) keeping the next byte in it.  end then goes on
+   as ctx does.  The body carries to the next line as eol. */
+static void dfa_quote(Dfa *d, DfaBuild *b, int ctx, char q, char esc,
+                      int body, int besc, int end, TokenType tok, int eol) {
+    char qs[2] = { q, 0 }, es[2] = { esc, 0 };
+    dfa_go(b, ctx, qs, body);
+    dfa_state(d, b, body, tok, eol);
+    dfa_go(b, body, qs, end);
+    if (esc) {
+        dfa_go(b, body, es, besc);
+        dfa_state(d, b, besc, tok, body);
+        dfa_all(b, besc, body);
     }
+    dfa_state(d, b, end, tok, d->eol[ctx]);
+    dfa_like(b, end, ctx);
 }
 
-static void lex_line_asm(const char *line, int len, LexState *ls, TokenType *out) {
-    (void)ls;
-    int i=0;
-    while(i<len) {
-        char c=line[i];
-        if (c==';') { while(i<len) out[i++]=TOK_COMMENT; break; }
-        if (c=='\''||c=='"') {
-            char d=c; out[i++]=TOK_STRING;
-            while(i<len){out[i]=TOK_STRING;if(line[i++]==d)break;}
-            continue;
-        }
-        if (c=='0'&&i+1<len&&(line[i+1]=='x'||line[i+1]=='X')) {
-            while(i<len&&(isxdigit((unsigned char)line[i])||line[i]=='x'||line[i]=='X')) out[i++]=TOK_NUMBER;
-            continue;
+/* A slash from ctx that may open a block comment, or a comment to the
+   end of the line when line is set. */
+static void dfa_c_comment(Dfa *d, DfaBuild *b, int ctx, int slash, int open,
+                          int body, int star, int end, int line,
+                          TokenType slash_tok) {
+    dfa_go(b, ctx, "/", slash);
+    dfa_state(d, b, slash, slash_tok, d->eol[ctx]);
+    dfa_like(b, slash, ctx);
+    dfa_go(b, slash, "*", open);
+    dfa_state(d, b, open, TOK_COMMENT, body);
+    d->back[open] = 1;
+    dfa_like(b, open, body);
+    dfa_state(d, b, body, TOK_COMMENT, body);
+    dfa_go(b, body, "*", star);
+    dfa_state(d, b, star, TOK_COMMENT, body);
+    dfa_all(b, star, body);
+    dfa_go(b, star, "*", star);
+    dfa_go(b, star, "/", end);
+    dfa_state(d, b, end, TOK_COMMENT, d->eol[ctx]);
+    dfa_like(b, end, ctx);
+    if (line >= 0) {
+        dfa_go(b, slash, "/", line);
+        dfa_state(d, b, line, TOK_COMMENT, 0);
+        d->back[line] = 1;
+    }
+}
+
+static void dfa_resolve(DfaBuild *b, int s, bool *done) {
+    if (done[s]) return;
+    done[s] = true;
+    int m = b->like[s];
+    if (m >= 0) dfa_resolve(b, m, done);
+    for (int c = 0; c < 256; c++)
+        if (b->t[s][c] == DFA_UNSET) b->t[s][c] = m >= 0 ? b->t[m][c] : (uint8_t)s;
+}
+
+/* Bytes of skip that loop in s, or leave it. */
+static void dfa_skips(Dfa *d, const DfaBuild *b, int s) {
+    uint8_t stay[256], out[256];
+    int ns = 0, no = 0;
+    for (int c = 0; c < 256; c++) {
+        if (b->t[s][c] == s) stay[ns++] = (uint8_t)c;
+        else                 out[no++]  = (uint8_t)c;
+    }
+    DfaSkip *k = &d->skip[s];
+    if (d->word[s] || !ns) return;
+    if (no <= 4)      { k->mode = SKIP_UNTIL; k->n = (uint8_t)no; memcpy(k->b, out, no); }
+    else if (ns <= 4) { k->mode = SKIP_WHILE; k->n = (uint8_t)ns; memcpy(k->b, stay, ns); }
+    for (int i = k->n; i < 4 && k->n; i++) k->b[i] = k->b[0];
+}
+
+/* Fold the rows into classes of bytes no state tells apart. */
+static void dfa_compile(Dfa *d, DfaBuild *b, int ks, int fold) {
+    bool done[DFA_STATES] = {0};
+    for (int s = 0; s < b->n; s++) dfa_resolve(b, s, done);
+    int ncls = 0, rep[DFA_CLASSES];
+    for (int c = 0; c < 256; c++) {
+        int k = 0;
+        for (; k < ncls; k++) {
+            int s = 0;
+            while (s < b->n && b->t[s][c] == b->t[s][rep[k]]) s++;
+            if (s == b->n) break;
         }
-        if (isdigit((unsigned char)c)) { while(i<len&&(isalnum((unsigned char)line[i])||line[i]=='.')) out[i++]=TOK_NUMBER; continue; }
-        if (isalpha((unsigned char)c)||c=='_'||c=='.') {
-            int s=i;
-            while(i<len&&(isalnum((unsigned char)line[i])||line[i]=='_'||line[i]=='.')) i++;
-            int wl=i-s;
-            char tmp[64]={0}; if(wl>63)wl=63;
-            for(int j=0;j<wl;j++) tmp[j]=tolower((unsigned char)line[s+j]);
-            TokenType tt=kw_match(kw_asm,tmp,wl)?TOK_KEYWORD:TOK_IDENT;
-            for(int j=s;j<i;j++) out[j]=tt;
-            continue;
+        if (k == ncls) {
+            if (ncls == DFA_CLASSES) abort();   /* tables below are fixed */
+            rep[ncls++] = c;
         }
-        if (c=='%'||c=='$') { out[i++]=TOK_PREPROC; continue; }
-        out[i++]=TOK_NORMAL;
+        d->cls[c] = (uint8_t)k;
+    }
+    for (int s = 0; s < b->n; s++) {
+        for (int k = 0; k < ncls; k++) d->next[s][k] = b->t[s][rep[k]];
+        dfa_skips(d, b, s);
+    }
+    d->ks   = ks;
+    d->fold = fold;
+}
+
+/* C, C++, C#, JS and PHP: the same machine over different keywords. */
+enum { C_BOL, C_NORMAL, C_OP, C_IDENT, C_NUM, C_PRE, C_PRE_ESC,
+       C_STR, C_STR_ESC, C_STR_END, C_CHR, C_CHR_ESC, C_CHR_END,
+       C_SLASH, C_OPEN, C_BLOCK, C_STAR, C_CLOSE, C_LINE };
+
+static void dfa_build_c(Dfa *d, DfaBuild *b) {
+    dfa_state(d, b, C_BOL, TOK_NORMAL, 0);
+    dfa_like(b, C_BOL, C_NORMAL);
+    dfa_go(b, C_BOL, " \t", C_BOL);
+    dfa_go(b, C_BOL, "#", C_PRE);
+    dfa_state(d, b, C_NORMAL, TOK_NORMAL, 0);
+    dfa_all(b, C_NORMAL, C_NORMAL);
+    dfa_go(b, C_NORMAL, OPS, C_OP);
+    dfa_go(b, C_NORMAL, ALPHA, C_IDENT);
+    dfa_go(b, C_NORMAL, "0-9", C_NUM);
+    dfa_state(d, b, C_OP, TOK_OPERATOR, 0);
+    dfa_like(b, C_OP, C_NORMAL);
+    dfa_state(d, b, C_IDENT, TOK_IDENT, 0);
+    d->word[C_IDENT] = true;
+    dfa_like(b, C_IDENT, C_NORMAL);
+    dfa_go(b, C_IDENT, ALNUM, C_IDENT);
+    dfa_state(d, b, C_NUM, TOK_NUMBER, 0);
+    dfa_like(b, C_NUM, C_NORMAL);
+    dfa_go(b, C_NUM, ALNUM ".", C_NUM);
+    /* Preprocessor lines run on through a trailing backslash */
+    dfa_state(d, b, C_PRE, TOK_PREPROC, 0);
+    dfa_go(b, C_PRE, "\\", C_PRE_ESC);
+    dfa_state(d, b, C_PRE_ESC, TOK_PREPROC, C_PRE);
+    dfa_all(b, C_PRE_ESC, C_PRE);
+    dfa_quote(d, b, C_NORMAL, '"', '\\', C_STR, C_STR_ESC, C_STR_END, TOK_STRING, 0);
+    dfa_quote(d, b, C_NORMAL, '\'', '\\', C_CHR, C_CHR_ESC, C_CHR_END, TOK_CHAR, 0);
+    dfa_c_comment(d, b, C_NORMAL, C_SLASH, C_OPEN, C_BLOCK, C_STAR, C_CLOSE,
+                  C_LINE, TOK_OPERATOR);
+}
+
+enum { P_NORMAL, P_OP, P_IDENT, P_NUM, P_COMMENT,
+       P_DQ1, P_DQ2, P_DQ, P_DQ_ESC, P_DQ_END,
+       P_TDQ, P_TDQ_ESC, P_TDQ_Q1, P_TDQ_Q2, P_TDQ_END,
+       P_SQ1, P_SQ2, P_SQ, P_SQ_ESC, P_SQ_END,
+       P_TSQ, P_TSQ_ESC, P_TSQ_Q1, P_TSQ_Q2, P_TSQ_END };
+
+/* A Python string on q: base is P_DQ1 or P_SQ1, followed by the other
+   nine states of the quote in enum order. */
+static void dfa_py_string(Dfa *d, DfaBuild *b, char q, int base) {
+    int q1 = base, q2 = base+1, body = base+2, esc = base+3, end = base+4;
+    int tbody = base+5, tesc = base+6, t1 = base+7, t2 = base+8, tend = base+9;
+    char qs[2] = { q, 0 };
+    dfa_go(b, P_NORMAL, qs, q1);
+    /* "x: a string; "": empty, or the start of """ */
+    dfa_state(d, b, q1, TOK_STRING, 0);
+    dfa_like(b, q1, body);
+    dfa_go(b, q1, qs, q2);
+    dfa_state(d, b, q2, TOK_STRING, 0);
+    dfa_like(b, q2, P_NORMAL);
+    dfa_go(b, q2, qs, tbody);
+    dfa_state(d, b, body, TOK_STRING, 0);
+    dfa_go(b, body, qs, end);
+    dfa_go(b, body, "\\", esc);
+    dfa_state(d, b, esc, TOK_STRING, body);
+    dfa_all(b, esc, body);
+    dfa_state(d, b, end, TOK_STRING, 0);
+    dfa_like(b, end, P_NORMAL);
+    dfa_state(d, b, tbody, TOK_STRING, tbody);
+    dfa_go(b, tbody, qs, t1);
+    dfa_go(b, tbody, "\\", tesc);
+    dfa_state(d, b, tesc, TOK_STRING, tbody);
+    dfa_all(b, tesc, tbody);
+    dfa_state(d, b, t1, TOK_STRING, tbody);
+    dfa_like(b, t1, tbody);
+    dfa_go(b, t1, qs, t2);
+    dfa_state(d, b, t2, TOK_STRING, tbody);
+    dfa_like(b, t2, tbody);
+    dfa_go(b, t2, qs, tend);
+    dfa_state(d, b, tend, TOK_STRING, 0);
+    dfa_like(b, tend, P_NORMAL);
+}
+
+static void dfa_build_py(Dfa *d, DfaBuild *b) {
+    dfa_state(d, b, P_NORMAL, TOK_NORMAL, 0);
+    dfa_all(b, P_NORMAL, P_NORMAL);
+    dfa_go(b, P_NORMAL, OPS, P_OP);
+    dfa_go(b, P_NORMAL, ALPHA, P_IDENT);
+    dfa_go(b, P_NORMAL, "0-9", P_NUM);
+    dfa_go(b, P_NORMAL, "#", P_COMMENT);
+    dfa_state(d, b, P_OP, TOK_OPERATOR, 0);
+    dfa_like(b, P_OP, P_NORMAL);
+    dfa_state(d, b, P_IDENT, TOK_IDENT, 0);
+    d->word[P_IDENT] = true;
+    dfa_like(b, P_IDENT, P_NORMAL);
+    dfa_go(b, P_IDENT, ALNUM, P_IDENT);
+    dfa_state(d, b, P_NUM, TOK_NUMBER, 0);
+    dfa_like(b, P_NUM, P_NORMAL);
+    dfa_go(b, P_NUM, ALNUM ".", P_NUM);
+    dfa_state(d, b, P_COMMENT, TOK_COMMENT, 0);
+    dfa_py_string(d, b, '"', P_DQ1);
+    dfa_py_string(d, b, '\'', P_SQ1);
+}
+
+enum { S_NORMAL, S_IDENT, S_NUM, S_VAR, S_COMMENT,
+       S_DQ, S_DQ_ESC, S_DQ_END, S_SQ, S_SQ_END };
+
+static void dfa_build_sh(Dfa *d, DfaBuild *b) {
+    dfa_state(d, b, S_NORMAL, TOK_NORMAL, 0);
+    dfa_all(b, S_NORMAL, S_NORMAL);
+    dfa_go(b, S_NORMAL, ALPHA, S_IDENT);
+    dfa_go(b, S_NORMAL, "0-9", S_NUM);
+    dfa_go(b, S_NORMAL, "$", S_VAR);
+    dfa_go(b, S_NORMAL, "#", S_COMMENT);
+    dfa_state(d, b, S_IDENT, TOK_IDENT, 0);
+    d->word[S_IDENT] = true;
+    dfa_like(b, S_IDENT, S_NORMAL);
+    dfa_go(b, S_IDENT, ALNUM "-", S_IDENT);
+    dfa_state(d, b, S_NUM, TOK_NUMBER, 0);
+    dfa_like(b, S_NUM, S_NORMAL);
+    dfa_go(b, S_NUM, "0-9", S_NUM);
+    /* $name, ${...}, $# and the like */
+    dfa_state(d, b, S_VAR, TOK_PREPROC, 0);
+    dfa_like(b, S_VAR, S_NORMAL);
+    dfa_go(b, S_VAR, ALNUM "{}#?@*!", S_VAR);
+    dfa_state(d, b, S_COMMENT, TOK_COMMENT, 0);
+    dfa_quote(d, b, S_NORMAL, '"', '\\', S_DQ, S_DQ_ESC, S_DQ_END, TOK_STRING, 0);
+    dfa_quote(d, b, S_NORMAL, '\'', 0, S_SQ, -1, S_SQ_END, TOK_STRING, 0);
+}
+
+enum { Q_NORMAL, Q_IDENT, Q_NUM, Q_DASH, Q_LINE, Q_STR, Q_STR_END,
+       Q_SLASH, Q_OPEN, Q_BLOCK, Q_STAR, Q_CLOSE };
+
+static void dfa_build_sql(Dfa *d, DfaBuild *b) {
+    dfa_state(d, b, Q_NORMAL, TOK_NORMAL, 0);
+    dfa_all(b, Q_NORMAL, Q_NORMAL);
+    dfa_go(b, Q_NORMAL, ALPHA, Q_IDENT);
+    dfa_go(b, Q_NORMAL, "0-9", Q_NUM);
+    dfa_go(b, Q_NORMAL, "-", Q_DASH);
+    dfa_state(d, b, Q_IDENT, TOK_IDENT, 0);
+    d->word[Q_IDENT] = true;
+    dfa_like(b, Q_IDENT, Q_NORMAL);
+    dfa_go(b, Q_IDENT, ALNUM, Q_IDENT);
+    dfa_state(d, b, Q_NUM, TOK_NUMBER, 0);
+    dfa_like(b, Q_NUM, Q_NORMAL);
+    dfa_go(b, Q_NUM, "0-9.", Q_NUM);
+    dfa_state(d, b, Q_DASH, TOK_NORMAL, 0);
+    dfa_like(b, Q_DASH, Q_NORMAL);
+    dfa_go(b, Q_DASH, "-", Q_LINE);
+    dfa_state(d, b, Q_LINE, TOK_COMMENT, 0);
+    d->back[Q_LINE] = 1;
+    dfa_quote(d, b, Q_NORMAL, '\'', 0, Q_STR, -1, Q_STR_END, TOK_STRING, 0);
+    dfa_c_comment(d, b, Q_NORMAL, Q_SLASH, Q_OPEN, Q_BLOCK, Q_STAR, Q_CLOSE,
+                  -1, TOK_NORMAL);
+}
+
+enum { M_NORMAL, M_IDENT, M_NUM, M_PRE, M_COMMENT,
+       M_DQ, M_DQ_END, M_SQ, M_SQ_END };
+
+static void dfa_build_asm(Dfa *d, DfaBuild *b) {
+    dfa_state(d, b, M_NORMAL, TOK_NORMAL, 0);
+    dfa_all(b, M_NORMAL, M_NORMAL);
+    dfa_go(b, M_NORMAL, ALPHA ".", M_IDENT);
+    dfa_go(b, M_NORMAL, "0-9", M_NUM);
+    dfa_go(b, M_NORMAL, "%$", M_PRE);
+    dfa_go(b, M_NORMAL, ";", M_COMMENT);
+    dfa_state(d, b, M_IDENT, TOK_IDENT, 0);
+    d->word[M_IDENT] = true;
+    dfa_like(b, M_IDENT, M_NORMAL);
+    dfa_go(b, M_IDENT, ALNUM ".", M_IDENT);
+    dfa_state(d, b, M_NUM, TOK_NUMBER, 0);
+    dfa_like(b, M_NUM, M_NORMAL);
+    dfa_go(b, M_NUM, ALNUM ".", M_NUM);
+    dfa_state(d, b, M_PRE, TOK_PREPROC, 0);
+    dfa_like(b, M_PRE, M_NORMAL);
+    dfa_state(d, b, M_COMMENT, TOK_COMMENT, 0);
+    dfa_quote(d, b, M_NORMAL, '"', 0, M_DQ, -1, M_DQ_END, TOK_STRING, 0);
+    dfa_quote(d, b, M_NORMAL, '\'', 0, M_SQ, -1, M_SQ_END, TOK_STRING, 0);
+}
+
+enum { J_NORMAL, J_OP, J_WORD, J_NUM, J_STR, J_STR_ESC, J_STR_END };
+
+static void dfa_build_json(Dfa *d, DfaBuild *b) {
+    dfa_state(d, b, J_NORMAL, TOK_NORMAL, 0);
+    dfa_all(b, J_NORMAL, J_NORMAL);
+    dfa_go(b, J_NORMAL, "{}[]:,", J_OP);
+    dfa_go(b, J_NORMAL, ALPHA, J_WORD);
+    dfa_go(b, J_NORMAL, "-0-9", J_NUM);
+    dfa_state(d, b, J_OP, TOK_OPERATOR, 0);
+    dfa_like(b, J_OP, J_NORMAL);
+    dfa_state(d, b, J_WORD, TOK_IDENT, 0);
+    d->word[J_WORD] = true;
+    dfa_like(b, J_WORD, J_NORMAL);
+    dfa_go(b, J_WORD, ALNUM, J_WORD);
+    dfa_state(d, b, J_NUM, TOK_NUMBER, 0);
+    dfa_like(b, J_NUM, J_NORMAL);
+    dfa_go(b, J_NUM, "0-9.eE+-", J_NUM);
+    dfa_quote(d, b, J_NORMAL, '"', '\\', J_STR, J_STR_ESC, J_STR_END, TOK_STRING, 0);
+}
+
+/* Tags, attributes and their values, entities, comments and <!...>
+   declarations.  Tags and comments may span lines. */
+enum { H_TEXT, H_ENT, H_ENT_END, H_LT, H_CLOSE, H_TAG, H_IN, H_ATTR,
+       H_EQ, H_GT, H_ADQ, H_ADQ_END, H_ASQ, H_ASQ_END, H_BANG, H_BANG_D,
+       H_DECL, H_DECL_END, H_COM_OPEN, H_COM, H_COM_D1, H_COM_D2,
+       H_COM_END };
+
+static void dfa_build_html(Dfa *d, DfaBuild *b) {
+    dfa_state(d, b, H_TEXT, TOK_NORMAL, 0);
+    dfa_go(b, H_TEXT, "<", H_LT);
+    dfa_go(b, H_TEXT, "&", H_ENT);
+    dfa_state(d, b, H_ENT, TOK_CHAR, 0);
+    dfa_like(b, H_ENT, H_TEXT);
+    dfa_go(b, H_ENT, ALNUM "#", H_ENT);
+    dfa_go(b, H_ENT, ";", H_ENT_END);
+    dfa_state(d, b, H_ENT_END, TOK_CHAR, 0);
+    dfa_like(b, H_ENT_END, H_TEXT);
+    dfa_state(d, b, H_LT, TOK_OPERATOR, 0);
+    dfa_all(b, H_LT, H_TEXT);
+    dfa_go(b, H_LT, "<", H_LT);
+    dfa_go(b, H_LT, "&", H_ENT);
+    dfa_go(b, H_LT, "/", H_CLOSE);
+    dfa_go(b, H_LT, "!", H_BANG);
+    dfa_go(b, H_LT, ALPHA, H_TAG);
+    dfa_state(d, b, H_CLOSE, TOK_OPERATOR, 0);
+    dfa_like(b, H_CLOSE, H_LT);
+    dfa_go(b, H_CLOSE, "/!", H_TEXT);
+    dfa_state(d, b, H_TAG, TOK_KEYWORD, H_IN);
+    dfa_like(b, H_TAG, H_IN);
+    dfa_go(b, H_TAG, ALNUM "-:", H_TAG);
+    dfa_state(d, b, H_IN, TOK_NORMAL, H_IN);
+    dfa_go(b, H_IN, ALPHA, H_ATTR);
+    dfa_go(b, H_IN, "=", H_EQ);
+    dfa_go(b, H_IN, ">", H_GT);
+    dfa_state(d, b, H_ATTR, TOK_TYPE, H_IN);
+    dfa_like(b, H_ATTR, H_IN);
+    dfa_go(b, H_ATTR, ALNUM "-:.", H_ATTR);
+    dfa_state(d, b, H_EQ, TOK_OPERATOR, H_IN);
+    dfa_like(b, H_EQ, H_IN);
+    dfa_state(d, b, H_GT, TOK_OPERATOR, 0);
+    dfa_like(b, H_GT, H_TEXT);
+    dfa_quote(d, b, H_IN, '"', 0, H_ADQ, -1, H_ADQ_END, TOK_STRING, H_ADQ);
+    dfa_quote(d, b, H_IN, '\'', 0, H_ASQ, -1, H_ASQ_END, TOK_STRING, H_ASQ);
+    /* "<!" starts a declaration, "<!--" a comment */
+    dfa_state(d, b, H_BANG, TOK_PREPROC, H_DECL);
+    d->back[H_BANG] = 1;
+    dfa_all(b, H_BANG, H_DECL);
+    dfa_go(b, H_BANG, "-", H_BANG_D);
+    dfa_go(b, H_BANG, ">", H_DECL_END);
+    dfa_state(d, b, H_BANG_D, TOK_PREPROC, H_DECL);
+    dfa_like(b, H_BANG_D, H_BANG);
+    dfa_go(b, H_BANG_D, "-", H_COM_OPEN);
+    dfa_state(d, b, H_DECL, TOK_PREPROC, H_DECL);
+    dfa_go(b, H_DECL, ">", H_DECL_END);
+    dfa_state(d, b, H_DECL_END, TOK_PREPROC, 0);
+    dfa_like(b, H_DECL_END, H_TEXT);
+    dfa_state(d, b, H_COM_OPEN, TOK_COMMENT, H_COM);
+    d->back[H_COM_OPEN] = 3;
+    dfa_like(b, H_COM_OPEN, H_COM);
+    dfa_state(d, b, H_COM, TOK_COMMENT, H_COM);
+    dfa_go(b, H_COM, "-", H_COM_D1);
+    dfa_state(d, b, H_COM_D1, TOK_COMMENT, H_COM);
+    dfa_all(b, H_COM_D1, H_COM);
+    dfa_go(b, H_COM_D1, "-", H_COM_D2);
+    dfa_state(d, b, H_COM_D2, TOK_COMMENT, H_COM);
+    dfa_all(b, H_COM_D2, H_COM);
+    dfa_go(b, H_COM_D2, "-", H_COM_D2);
+    dfa_go(b, H_COM_D2, ">", H_COM_END);
+    dfa_state(d, b, H_COM_END, TOK_COMMENT, 0);
+    dfa_like(b, H_COM_END, H_TEXT);
+}
+
+/* Selectors outside braces, property: value pairs inside.  Comments and
+   strings come back to the context they were opened in. */
+enum { X_SEL, X_ELEM, X_CLASS, X_PSEUDO, X_AT, X_ATP, X_SOP,
+       X_BLK, X_PROP, X_BOP, X_VAL, X_NUM, X_HASH, X_IMP, X_VWORD, X_VOP,
+       X_SDQ, X_SDQ_ESC, X_SDQ_END, X_SSQ, X_SSQ_ESC, X_SSQ_END,
+       X_VDQ, X_VDQ_ESC, X_VDQ_END, X_VSQ, X_VSQ_ESC, X_VSQ_END,
+       X_COMMENT };    /* then five states per context, see below */
+
+static void dfa_build_css(Dfa *d, DfaBuild *b) {
+    dfa_state(d, b, X_SEL, TOK_NORMAL, 0);
+    dfa_go(b, X_SEL, ALPHA "*", X_ELEM);
+    dfa_go(b, X_SEL, ".#", X_CLASS);
+    dfa_go(b, X_SEL, ":", X_PSEUDO);
+    dfa_go(b, X_SEL, "@", X_AT);
+    dfa_go(b, X_SEL, ",>+~[]()=", X_SOP);
+    dfa_go(b, X_SEL, "{", X_BOP);
+    dfa_state(d, b, X_ELEM, TOK_KEYWORD, 0);
+    dfa_like(b, X_ELEM, X_SEL);
+    dfa_go(b, X_ELEM, ALNUM "-", X_ELEM);
+    dfa_state(d, b, X_CLASS, TOK_TYPE, 0);
+    dfa_like(b, X_CLASS, X_SEL);
+    dfa_go(b, X_CLASS, ALNUM "-", X_CLASS);
+    dfa_state(d, b, X_PSEUDO, TOK_PREPROC, 0);
+    dfa_like(b, X_PSEUDO, X_SEL);
+    dfa_go(b, X_PSEUDO, ALNUM "-:", X_PSEUDO);
+    /* An at-rule's block (@media) holds rules, not declarations */
+    dfa_state(d, b, X_AT, TOK_PREPROC, X_ATP);
+    dfa_like(b, X_AT, X_ATP);
+    dfa_go(b, X_AT, ALNUM "-", X_AT);
+    dfa_state(d, b, X_ATP, TOK_NORMAL, X_ATP);
+    dfa_go(b, X_ATP, "{;", X_SOP);
+    dfa_state(d, b, X_SOP, TOK_OPERATOR, 0);
+    dfa_like(b, X_SOP, X_SEL);
+
+    dfa_state(d, b, X_BLK, TOK_NORMAL, X_BLK);
+    dfa_go(b, X_BLK, ALPHA "-", X_PROP);
+    dfa_go(b, X_BLK, ":", X_VOP);
+    dfa_go(b, X_BLK, ";{", X_BOP);
+    dfa_go(b, X_BLK, "}", X_SOP);
+    dfa_state(d, b, X_PROP, TOK_TYPE, X_BLK);
+    dfa_like(b, X_PROP, X_BLK);
+    dfa_go(b, X_PROP, ALNUM "-", X_PROP);
+    dfa_state(d, b, X_BOP, TOK_OPERATOR, X_BLK);
+    dfa_like(b, X_BOP, X_BLK);
+
+    dfa_state(d, b, X_VAL, TOK_NORMAL, X_VAL);
+    dfa_go(b, X_VAL, "0-9.", X_NUM);
+    dfa_go(b, X_VAL, "#", X_HASH);
+    dfa_go(b, X_VAL, "!", X_IMP);
+    dfa_go(b, X_VAL, ALPHA "-", X_VWORD);
+    dfa_go(b, X_VAL, ",()/*+:", X_VOP);
+    dfa_go(b, X_VAL, ";{", X_BOP);
+    dfa_go(b, X_VAL, "}", X_SOP);
+    dfa_state(d, b, X_NUM, TOK_NUMBER, X_VAL);
+    dfa_like(b, X_NUM, X_VAL);
+    dfa_go(b, X_NUM, ALNUM ".%", X_NUM);
+    dfa_state(d, b, X_HASH, TOK_NUMBER, X_VAL);
+    dfa_like(b, X_HASH, X_VAL);
+    dfa_go(b, X_HASH, ALNUM, X_HASH);
+    dfa_state(d, b, X_IMP, TOK_KEYWORD, X_VAL);
+    dfa_like(b, X_IMP, X_VAL);
+    dfa_go(b, X_IMP, ALPHA, X_IMP);
+    dfa_state(d, b, X_VWORD, TOK_NORMAL, X_VAL);
+    dfa_like(b, X_VWORD, X_VAL);
+    dfa_go(b, X_VWORD, ALNUM "-", X_VWORD);
+    dfa_state(d, b, X_VOP, TOK_OPERATOR, X_VAL);
+    dfa_like(b, X_VOP, X_VAL);
+
+    dfa_quote(d, b, X_SEL, '"', '\\', X_SDQ, X_SDQ_ESC, X_SDQ_END, TOK_STRING, 0);
+    dfa_quote(d, b, X_SEL, '\'', '\\', X_SSQ, X_SSQ_ESC, X_SSQ_END, TOK_STRING, 0);
+    dfa_quote(d, b, X_VAL, '"', '\\', X_VDQ, X_VDQ_ESC, X_VDQ_END, TOK_STRING, X_VAL);
+    dfa_quote(d, b, X_VAL, '\'', '\\', X_VSQ, X_VSQ_ESC, X_VSQ_END, TOK_STRING, X_VAL);
+    int ctx[3] = { X_SEL, X_BLK, X_VAL };
+    for (int i = 0; i < 3; i++) {
+        int s = X_COMMENT + 5*i;
+        dfa_c_comment(d, b, ctx[i], s, s+1, s+2, s+3, s+4, -1,
+                      ctx[i] == X_VAL ? TOK_OPERATOR : TOK_NORMAL);
+    }
+}
+
+static void dfa_init(void) {
+    static DfaBuild b;
+    static void (*const build[DFA_COUNT])(Dfa *, DfaBuild *) = {
+        [DFA_C] = dfa_build_c,       [DFA_PY] = dfa_build_py,
+        [DFA_SH] = dfa_build_sh,     [DFA_SQL] = dfa_build_sql,
+        [DFA_ASM] = dfa_build_asm,   [DFA_JSON] = dfa_build_json,
+        [DFA_HTML] = dfa_build_html, [DFA_CSS] = dfa_build_css,
+    };
+    static const int ks[DFA_COUNT][2] = {
+        [DFA_C] = { KS_C, 0 },       [DFA_PY] = { KS_PY, 0 },
+        [DFA_SH] = { KS_SH, 0 },     [DFA_SQL] = { KS_SQL, 'A' },
+        [DFA_ASM] = { KS_ASM, 'a' }, [DFA_JSON] = { KS_JSON, 0 },
+        [DFA_HTML] = { -1, 0 },      [DFA_CSS] = { -1, 0 },
+        [DFA_NONE] = { -1, 0 },
+    };
+    for (int i = 0; i < DFA_COUNT; i++) {
+        dfa_begin(&b);
+        if (build[i]) build[i](&dfa_tab[i], &b);
+        else dfa_state(&dfa_tab[i], &b, 0, TOK_NORMAL, 0);
+        dfa_compile(&dfa_tab[i], &b, ks[i][0], ks[i][1]);
+    }
+    dfa_c = dfa_cpp = dfa_cs = dfa_js = dfa_tab[DFA_C];
+    dfa_cpp.ks = KS_CPP;
+    dfa_cs.ks  = KS_CS;
+    dfa_js.ks  = KS_JS;
+}
+
+static void lex_init(void) {
+    kw_init();
+    dfa_init();
+}
+
+static const Dfa *dfa_for(Language lang) {
+    switch (lang) {
+        case LANG_C:    return &dfa_c;
+        case LANG_CPP:  return &dfa_cpp;
+        case LANG_CS:   return &dfa_cs;
+        case LANG_JS:
+        case LANG_PHP:  return &dfa_js;
+        case LANG_PY:   return &dfa_tab[DFA_PY];
+        case LANG_SH:   return &dfa_tab[DFA_SH];
+        case LANG_SQL:  return &dfa_tab[DFA_SQL];
+        case LANG_ASM:  return &dfa_tab[DFA_ASM];
+        case LANG_JSON: return &dfa_tab[DFA_JSON];
+        case LANG_HTML: return &dfa_tab[DFA_HTML];
+        case LANG_CSS:  return &dfa_tab[DFA_CSS];
+        default:        return &dfa_tab[DFA_NONE];
+    }
+}
+
+/* First byte of t[i, len) that is (SKIP_UNTIL) or is not (SKIP_WHILE)
+   one of k->b. */
+static size_t dfa_skip(const char *t, size_t i, size_t len, const DfaSkip *k) {
+    if (k->mode == SKIP_UNTIL && !k->n) return len;
+    bool until = k->mode == SKIP_UNTIL;
+#if defined(__AVX2__)
+    __m256i c0 = _mm256_set1_epi8((char)k->b[0]), c1 = _mm256_set1_epi8((char)k->b[1]);
+    __m256i c2 = _mm256_set1_epi8((char)k->b[2]), c3 = _mm256_set1_epi8((char)k->b[3]);
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(t + i));
+        __m256i m = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, c0), _mm256_cmpeq_epi8(v, c1)),
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, c2), _mm256_cmpeq_epi8(v, c3)));
+        uint32_t bits = (uint32_t)_mm256_movemask_epi8(m);
+        if (!until) bits = ~bits;
+        if (bits) return i + (size_t)__builtin_ctz(bits);
+    }
+#elif defined(__SSE2__)
+    __m128i c0 = _mm_set1_epi8((char)k->b[0]), c1 = _mm_set1_epi8((char)k->b[1]);
+    __m128i c2 = _mm_set1_epi8((char)k->b[2]), c3 = _mm_set1_epi8((char)k->b[3]);
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(t + i));
+        __m128i m = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, c0), _mm_cmpeq_epi8(v, c1)),
+            _mm_or_si128(_mm_cmpeq_epi8(v, c2), _mm_cmpeq_epi8(v, c3)));
+        uint32_t bits = (uint32_t)_mm_movemask_epi8(m);
+        if (!until) bits = ~bits & 0xffff;
+        if (bits) return i + (size_t)__builtin_ctz(bits);
     }
+#endif
+    for (; i < len; i++) {
+        uint8_t c = (uint8_t)t[i];
+        bool hit = c == k->b[0] || c == k->b[1] || c == k->b[2] || c == k->b[3];
+        if (hit == until) break;
+    }
+    return i;
+}
+
+/* Repaint the word text[a, b) if it is a keyword or type. */
+static void dfa_word(const Dfa *d, const char *text, size_t a, size_t b,
+                     TokenType *out) {
+    size_t n = b - a;
+    if (d->ks < 0 || n > KW_LENMAX) return;
+    char tmp[KW_LENMAX];
+    const char *w = text + a;
+    if (d->fold) {
+        for (size_t i = 0; i < n; i++)
+            tmp[i] = (char)(d->fold == 'A' ? toupper((unsigned char)w[i])
+                                           : tolower((unsigned char)w[i]));
+        w = tmp;
+    }
+    TokenType t = kw_class(d->ks, w, (int)n);
+    if (t != TOK_IDENT)
+        for (size_t i = a; i < b; i++) out[i] = t;
 }
 
-static void lex_line_generic(const char *line, int len, LexState *ls, TokenType *out) {
-    (void)ls; (void)line;
-    for(int i=0;i<len;i++) out[i]=TOK_NORMAL;
+/* Lex one line of text starting in state; returns the state at its end. */
+static int lex_text(Language lang, const char *text, size_t len, int state,
+                    TokenType *out) {
+    const Dfa *d = dfa_for(lang);
+    const uint8_t *cls = d->cls;
+    int st = state;
+    size_t ws = 0;      /* start of the word being read */
+    for (size_t i = 0; ; ) {
+        /* Bytes that keep st */
+        TokenType tok = (TokenType)d->tok[st];
+        const uint8_t *row = d->next[st];
+        if (d->skip[st].mode != SKIP_NONE) {
+            size_t j = dfa_skip(text, i, len, &d->skip[st]);
+            for (; i < j; i++) out[i] = tok;
+        }
+        while (i < len && row[cls[(uint8_t)text[i]]] == st) out[i++] = tok;
+        if (i == len) break;
+
+        int ns = row[cls[(uint8_t)text[i]]];
+        if (d->word[st]) dfa_word(d, text, ws, i, out);
+        if (d->word[ns]) ws = i;
+        for (size_t n = min_sz(d->back[ns], i); n; n--)
+            out[i-n] = (TokenType)d->tok[ns];
+        out[i++] = (TokenType)d->tok[ns];
+        st = ns;
+    }
+    if (d->word[st]) dfa_word(d, text, ws, len, out);
+    return d->eol[st];
 }
 
 /* ─── SynCtx ──────────────────────────────────────────────────── */
+/* Lines [0, frontier) have been lexed through in order, so the entry state
+   of every line up to frontier is known (front_state for frontier itself).
+   Along the way a checkpoint is kept every SYN_CKPT_LINES lines: the entry
+   state of any line below the frontier is then at most that many lines of
+   lexing away.
+
+   An edit pulls the frontier back above it but keeps what lies beyond:
+   up to horizon, the lines and checkpoints still hold the states they had
+   before, moved with their lines.  Once the frontier is past the edited
+   lines (dirty_hi) and arrives somewhere in the state stored there,
+   lexing has converged and the frontier jumps to the horizon. */
+
+#define SYN_ARENA 65536
+
+static void scratch_free(struct SynScratch *sc);
+
+static inline LineAttr *la_at(const SynCtx *s, size_t line) {
+    return &s->lines[line < s->gap ? line : line + s->cap - s->count];
+}
 
 SynCtx *syn_new(Language lang) {
+    pthread_once(&lex_once, lex_init);
     SynCtx *s = calloc(1, sizeof *s);
     s->lang = lang;
     s->cap = 256;
-    s->lines = calloc(s->cap, sizeof(LineAttr));
-    for (size_t i = 0; i < s->cap; i++) s->lines[i].dirty = true;
+    s->lines = malloc(s->cap * sizeof(LineAttr));
+    s->ckcap = 64;
+    s->ckpt  = malloc(s->ckcap * sizeof(SynCkpt));
+    s->ckpt[0] = (SynCkpt){ 0, 0 };
+    s->nckpt = 1;
+    s->arena = arena_new(SYN_ARENA);
+    /* Recursive: edits hold the lock across syn_edit */
+    pthread_mutexattr_t ma;
+    pthread_mutexattr_init(&ma);
+    pthread_mutexattr_settype(&ma, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&s->mu, &ma);
+    pthread_mutexattr_destroy(&ma);
+    pthread_cond_init(&s->wake, NULL);
+    pthread_cond_init(&s->done, NULL);
     return s;
 }
 
 void syn_free(SynCtx *s) {
     if (!s) return;
-    for (size_t i=0;i<s->count;i++) free(s->lines[i].attrs);
+    if (s->running) {
+        pthread_mutex_lock(&s->mu);
+        s->quit = true;
+        pthread_cond_signal(&s->wake);
+        pthread_mutex_unlock(&s->mu);
+        pthread_join(s->thread, NULL);
+    }
+    if (s->scratch) scratch_free(s->scratch);
+    free(s->scratch);
+    arena_free(s->arena);
     free(s->lines);
+    free(s->ckpt);
+    pthread_mutex_destroy(&s->mu);
+    pthread_cond_destroy(&s->wake);
+    pthread_cond_destroy(&s->done);
     free(s);
 }
 
-void syn_mark_dirty_from(SynCtx *s, size_t line) {
-    for (size_t i=line; i<s->count; i++) s->lines[i].dirty=true;
+void syn_lock(SynCtx *s)   { pthread_mutex_lock(&s->mu); }
+void syn_unlock(SynCtx *s) { pthread_mutex_unlock(&s->mu); }
+
+/* ─── Line array ─────────────────────────────────────────────── */
+/* lines is a gap array, like the text: lines [0, gap) at the front of
+   the allocation, the rest at its back.  Lines added or removed by an
+   edit only move the entries between the last edit and this one, and
+   the attrs of every other line stay with their text. */
+
+static void move_line_gap(SynCtx *s, size_t pos) {
+    size_t gs = s->cap - s->count;
+    if (pos < s->gap)
+        memmove(s->lines + pos + gs, s->lines + pos, (s->gap - pos) * sizeof(LineAttr));
+    else if (pos > s->gap)
+        memmove(s->lines + s->gap, s->lines + s->gap + gs, (pos - s->gap) * sizeof(LineAttr));
+    s->gap = pos;
 }
 
-static void ensure_line_cap(SynCtx *s, size_t line) {
-    if (line >= s->cap) {
-        size_t new_cap = line + 256;
+/* Insert k dirty lines before line at. */
+static void insert_lines(SynCtx *s, size_t at, size_t k) {
+    move_line_gap(s, at);
+    if (s->cap - s->count < k) {
+        size_t tail = s->count - s->gap;
+        size_t new_cap = max_sz(s->cap * 2, s->count + k + 256);
         s->lines = realloc(s->lines, new_cap * sizeof(LineAttr));
-        for (size_t i=s->cap; i<new_cap; i++) {
-            memset(&s->lines[i], 0, sizeof(LineAttr));
-            s->lines[i].dirty = true;
-        }
+        memmove(s->lines + new_cap - tail, s->lines + s->cap - tail, tail * sizeof(LineAttr));
         s->cap = new_cap;
     }
-    if (line >= s->count) s->count = line + 1;
+    memset(s->lines + s->gap, 0, k * sizeof(LineAttr));
+    for (size_t i = 0; i < k; i++) s->lines[s->gap + i].dirty = true;
+    s->gap   += k;
+    s->count += k;
 }
 
-void syn_ensure_line(SynCtx *s, size_t line, const GapBuf *g, const LineIdx *li) {
-    ensure_line_cap(s, line);
-    LineAttr *la = &s->lines[line];
-    if (!la->dirty) return;
+static void delete_lines(SynCtx *s, size_t at, size_t k) {
+    move_line_gap(s, at);
+    for (size_t i = 0; i < k; i++) s->live -= la_at(s, at + i)->runs_cap;
+    s->count -= k;
+}
+
+static void ensure_line_cap(SynCtx *s, size_t line) {
+    if (line >= s->count) insert_lines(s, s->count, line + 1 - s->count);
+}
+
+LineAttr *syn_line(SynCtx *s, size_t line) { return la_at(s, line); }
+
+/* ─── Checkpoints ────────────────────────────────────────────── */
+
+/* Index of the first checkpoint past line. */
+static size_t ckpt_after(const SynCtx *s, size_t line) {
+    size_t lo = 0, hi = s->nckpt;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (s->ckpt[mid].line <= line) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+}
+
+/* The pass reached line in state: refresh the checkpoint there, or add
+   one if the previous is SYN_CKPT_LINES away. */
+static void ckpt_note(SynCtx *s, size_t line, int state) {
+    size_t k = ckpt_after(s, line);
+    if (s->ckpt[k-1].line == line) { s->ckpt[k-1].state = state; return; }
+    if (line - s->ckpt[k-1].line < SYN_CKPT_LINES) return;
+    if (s->nckpt == s->ckcap) {
+        s->ckcap *= 2;
+        s->ckpt = realloc(s->ckpt, s->ckcap * sizeof(SynCkpt));
+    }
+    memmove(s->ckpt + k + 1, s->ckpt + k, (s->nckpt - k) * sizeof(SynCkpt));
+    s->ckpt[k] = (SynCkpt){ line, state };
+    s->nckpt++;
+}
+
+static void set_frontier(SynCtx *s, size_t line, int state) {
+    s->frontier    = line;
+    s->front_state = state;
+    if (line >= s->horizon) {
+        s->horizon       = line;
+        s->horizon_state = state;
+        s->dirty_hi      = 0;
+    }
+}
+
+/* Move the frontier back to the checkpoint above line (lock held). */
+static void pull_frontier(SynCtx *s, size_t line) {
+    if (line >= s->frontier) return;
+    const SynCkpt *c = &s->ckpt[ckpt_after(s, line) - 1];
+    s->frontier    = c->line;
+    s->front_state = c->state;
+}
+
+/* The frontier reached line in state: if that is the state stored there
+   from before the edits, everything up to the horizon still holds. */
+static bool converge(SynCtx *s, size_t line, int state) {
+    if (line < s->dirty_hi || line >= s->horizon) return false;
+    size_t k = ckpt_after(s, line);
+    bool same = s->ckpt[k-1].line == line ? s->ckpt[k-1].state == state
+              : line < s->count && !la_at(s, line)->dirty &&
+                la_at(s, line)->lex_state_start == state;
+    if (same) set_frontier(s, s->horizon, s->horizon_state);
+    return same;
+}
+
+static void wake_worker(SynCtx *s) {
+    s->version++;
+    s->busy = true;
+    pthread_cond_signal(&s->wake);
+}
+
+/* Everything from line on must be lexed again. */
+void syn_mark_dirty_from(SynCtx *s, size_t line) {
+    pthread_mutex_lock(&s->mu);
+    for (size_t i=line; i<s->count; i++) {
+        la_at(s, i)->dirty  = true;
+        la_at(s, i)->approx = false;
+    }
+    pull_frontier(s, line);
+    s->horizon       = s->frontier;
+    s->horizon_state = s->front_state;
+    s->dirty_hi      = 0;
+    wake_worker(s);
+    pthread_mutex_unlock(&s->mu);
+}
+
+/* Lines [line, line+old_n) were replaced by new_n lines.  Costs the
+   changed lines only, whether or not the line count changed. */
+void syn_edit(SynCtx *s, size_t line, size_t old_n, size_t new_n) {
+    pthread_mutex_lock(&s->mu);
+    size_t end = line + old_n;
+
+    /* A first edit turns the frontier into the horizon; after more edits
+       whatever the frontier has relexed since is part of the dirty range */
+    size_t from = line > 0 ? line-1 : 0;
+    if (from < s->frontier) {
+        if (s->frontier >= s->horizon) {
+            s->horizon       = s->frontier;
+            s->horizon_state = s->front_state;
+            s->dirty_hi      = line;
+        } else {
+            s->dirty_hi = max_sz(s->dirty_hi, s->frontier);
+        }
+        pull_frontier(s, from);
+    }
 
-    size_t lcount = li_line_count(li);
-    if (line >= lcount) { la->dirty=false; return; }
+    /* Checkpoints inside the edit go, those below it move with their lines */
+    size_t j = ckpt_after(s, line);
+    for (size_t k = j; k < s->nckpt; k++) {
+        if (s->ckpt[k].line < end) continue;
+        s->ckpt[k].line = s->ckpt[k].line - old_n + new_n;
+        s->ckpt[j++] = s->ckpt[k];
+    }
+    s->nckpt = j;
+
+    if (s->horizon > line) {
+        if (s->horizon < end) {
+            /* The edit swallowed it */
+            s->horizon       = s->frontier;
+            s->horizon_state = s->front_state;
+            s->dirty_hi      = 0;
+        } else {
+            s->horizon = s->horizon - old_n + new_n;
+            if (s->dirty_hi > line)
+                s->dirty_hi = max_sz(s->dirty_hi, end) - old_n + new_n;
+            s->dirty_hi = max_sz(s->dirty_hi, line + new_n);
+        }
+    }
+
+    /* Line attrs follow their lines; only the edited ones need lexing */
+    if (line < s->count) {
+        size_t have = min_sz(end, s->count);
+        if (new_n > old_n)
+            insert_lines(s, have, new_n - old_n);
+        else if (old_n > new_n && line + new_n < have)
+            delete_lines(s, line + new_n, min_sz(old_n - new_n, have - line - new_n));
+    }
+    for (size_t i = from; i < min_sz(line + new_n, s->count); i++) {
+        la_at(s, i)->dirty  = true;
+        la_at(s, i)->approx = false;
+    }
+    wake_worker(s);
+    pthread_mutex_unlock(&s->mu);
+}
 
-    size_t start = li_line_start(li, line);
-    size_t end = (line+1 < lcount) ? li_line_start(li, line+1)-1 : gb_len(g);
-    if (end < start) end = start;
-    size_t len = end - start;
+_Static_assert(_TOK_COUNT <= 16, "token runs keep the token in a nibble");
 
-    if (len > la->len || !la->attrs) {
-        free(la->attrs);
-        la->attrs = malloc((len+1) * sizeof(TokenType));
+/* Pack attrs[0..len) into the runs syn_run reads, to out when set;
+   returns the bytes needed. */
+static size_t pack_runs(const TokenType *attrs, size_t len, uint8_t *out) {
+    size_t n = 0;
+#define PUT(b) do { if (out) out[n] = (uint8_t)(b); n++; } while (0)
+    for (size_t i = 0, k; i < len; i = k) {
+        for (k = i + 1; k < len && attrs[k] == attrs[i]; k++) ;
+        size_t rl = k - i;
+        if (rl < 16) { PUT(attrs[i] << 4 | rl); continue; }
+        PUT(attrs[i] << 4);
+        for (; rl >= 0x80; rl >>= 7) PUT(rl | 0x80);
+        PUT(rl);
     }
-    la->len = len;
+#undef PUT
+    return n;
+}
 
-    char *tmp = malloc(len+1);
-    gb_get_range(g, start, len, tmp);
-    tmp[len]='\0';
+/* Move the runs of every line into a fresh arena, leaving behind those
+   of lines since relexed or deleted. */
+static void syn_compact(SynCtx *s) {
+    Arena *a = arena_new(SYN_ARENA);
+    for (size_t i = 0; i < s->count; i++) {
+        LineAttr *la = la_at(s, i);
+        if (!la->runs_cap) continue;
+        uint8_t *r = arena_alloc(a, la->runs_cap);
+        memcpy(r, la->runs, la->runs_len);
+        la->runs = r;
+    }
+    arena_free(s->arena);
+    s->arena = a;
+    s->used  = s->live;
+}
 
-    int in_state = (line > 0 && line <= s->count) ? s->lines[line-1].lex_state_end : 0;
-    LexState ls = { .state = in_state };
+/* Store the attrs of a lexed line as runs (lock held).  Runs live in the
+   arena and are rewritten in place while they fit. */
+static void install_line(SynCtx *s, size_t line, const TokenType *attrs,
+                         size_t len, int in_state, int out_state, bool approx) {
+    ensure_line_cap(s, line);
+    LineAttr *la = la_at(s, line);
+    size_t n = pack_runs(attrs, len, NULL);
+    if (n > UINT32_MAX) n = len = 0;    /* drawn plain */
+    if (n > la->runs_cap) {
+        s->live -= la->runs_cap;
+        la->runs_cap = (uint32_t)min_sz((n + 7) & ~(size_t)7, UINT32_MAX);
+        la->runs = arena_alloc(s->arena, la->runs_cap);
+        s->used += la->runs_cap;
+        s->live += la->runs_cap;
+    }
+    la->runs_len = (uint32_t)pack_runs(attrs, len, la->runs);
+    la->len   = len;
     la->lex_state_start = in_state;
+    la->lex_state_end   = out_state;
+    la->approx = approx;
+    la->dirty  = approx;
+    if (s->used > 2 * s->live + SYN_ARENA) syn_compact(s);
+}
 
-    for (size_t i=0;i<len;i++) la->attrs[i]=TOK_NORMAL;
+/* ─── Lexing jobs ────────────────────────────────────────────── */
+/* A job lexes lines [a, b) from state; the attrs of the last line are
+   kept when attrs is set.  advance moves the frontier (a == frontier). */
 
-    switch (s->lang) {
-        case LANG_C:   lex_line_c_like(tmp,(int)len,&ls,la->attrs,LANG_C,false); break;
-        case LANG_CPP: lex_line_c_like(tmp,(int)len,&ls,la->attrs,LANG_CPP,true); break;
-        case LANG_CS:  lex_line_c_like(tmp,(int)len,&ls,la->attrs,LANG_CS,true); break;
-        case LANG_JS:
-        case LANG_PHP: lex_line_c_like(tmp,(int)len,&ls,la->attrs,LANG_JS,true); break;
-        case LANG_PY:  lex_line_python(tmp,(int)len,&ls,la->attrs); break;
-        case LANG_SH:  lex_line_sh(tmp,(int)len,&ls,la->attrs); break;
-        case LANG_SQL: lex_line_sql(tmp,(int)len,&ls,la->attrs); break;
-        case LANG_ASM: lex_line_asm(tmp,(int)len,&ls,la->attrs); break;
-        default:       lex_line_generic(tmp,(int)len,&ls,la->attrs); break;
+#define SYN_GUESS_LINES 512
+#define SYN_PASS_LINES  4096
+#define SYN_PASS_BYTES  (1u << 20)
+
+typedef struct {
+    size_t a, b;
+    int    state;
+    bool   attrs, advance, approx;
+} SynJob;
+
+typedef struct SynScratch {
+    char      *text;
+    TokenType *attrs;
+    int       *states;
+    size_t     tcap, acap, scap;
+} SynScratch;
+
+static bool line_ready(const SynCtx *s, size_t line) {
+    return line < s->count && !la_at(s, line)->dirty;
+}
+
+/* Next job for lines [lo, hi), or false when they are all lexed (lock
+   held).  guess allows approx lines when the frontier is far above. */
+static bool pick_job(SynCtx *s, size_t lo, size_t hi, bool guess, SynJob *j) {
+    size_t n = li_line_count(s->li);
+    hi = min_sz(hi, n);
+
+    /* Lines still lexed with the state the frontier brings need no work */
+    while (s->frontier < hi) {
+        size_t f = s->frontier;
+        if (converge(s, f, s->front_state)) continue;
+        if (!line_ready(s, f) || la_at(s, f)->lex_state_start != s->front_state)
+            break;
+        set_frontier(s, f + 1, la_at(s, f)->lex_state_end);
+        ckpt_note(s, f + 1, s->front_state);
+    }
+
+    if (guess && lo > s->frontier + SYN_GUESS_LINES) {
+        for (size_t v = lo; v < hi; v++) {
+            if (v < s->count && (!la_at(s, v)->dirty || la_at(s, v)->approx))
+                continue;
+            bool up = v - 1 < s->count && (!la_at(s, v-1)->dirty || la_at(s, v-1)->approx);
+            *j = (SynJob){ v, v + 1, up ? la_at(s, v-1)->lex_state_end : 0,
+                           true, false, true };
+            return true;
+        }
+    }
+
+    /* Below the frontier: from the line above, or the nearest checkpoint */
+    for (size_t v = lo; v < hi && v < s->frontier; v++) {
+        if (line_ready(s, v)) continue;
+        if (v > 0 && line_ready(s, v - 1)) {
+            *j = (SynJob){ v, v + 1, la_at(s, v-1)->lex_state_end, true, false, false };
+        } else {
+            const SynCkpt *c = &s->ckpt[ckpt_after(s, v) - 1];
+            *j = (SynJob){ c->line, v + 1, c->state, true, false, false };
+        }
+        return true;
     }
 
-    la->lex_state_end = ls.state;
+    if (s->frontier >= hi) return false;
+    size_t a = s->frontier;
+    if (a >= lo) {
+        *j = (SynJob){ a, a + 1, s->front_state, true, true, false };
+        return true;
+    }
+    /* Off screen: walk the states only, a slice at a time */
+    size_t b = min_sz(lo, a + SYN_PASS_LINES);
+    size_t start = li_line_start(s->li, a);
+    if (li_line_end(s->li, b - 1, s->g) - start > SYN_PASS_BYTES)
+        b = max_sz(a + 1, li_line_of(s->li, start + SYN_PASS_BYTES));
+    *j = (SynJob){ a, b, s->front_state, false, true, false };
+    return true;
+}
+
+/* Run j (lock held; dropped around the lexing itself when unlock). */
+static void run_job(SynCtx *s, const SynJob *j, SynScratch *sc, bool unlock) {
+    size_t nl    = j->b - j->a;
+    size_t start = li_line_start(s->li, j->a);
+    size_t end   = li_line_end(s->li, j->b - 1, s->g);
+    size_t len   = end > start ? end - start : 0;
+    if (len + 1 > sc->tcap) {
+        sc->tcap = len + 1;
+        sc->text = realloc(sc->text, sc->tcap);
+    }
+    if (nl + 1 > sc->scap) {
+        sc->scap = nl + 1;
+        sc->states = realloc(sc->states, sc->scap * sizeof(int));
+    }
+    gb_get_range(s->g, start, len, sc->text);
+    uint64_t version = s->version;
+    Language lang = s->lang;
+    if (unlock) pthread_mutex_unlock(&s->mu);
+
+    const char *t = sc->text, *e = sc->text + len;
+    int st = j->state;
+    size_t ll = 0;
+    for (size_t i = 0; i < nl; i++) {
+        const char *nlp = i + 1 < nl ? memchr(t, '\n', (size_t)(e - t)) : NULL;
+        ll = nlp ? (size_t)(nlp - t) : (size_t)(e - t);
+        if (ll + 1 > sc->acap) {
+            sc->acap = ll + 1;
+            sc->attrs = realloc(sc->attrs, sc->acap * sizeof(TokenType));
+        }
+        sc->states[i] = st;
+        st = lex_text(lang, t, ll, st, sc->attrs);
+        t = nlp ? nlp + 1 : e;
+    }
+    sc->states[nl] = st;
+
+    if (unlock) pthread_mutex_lock(&s->mu);
+    if (s->version != version) return;
+    if (j->advance) {
+        size_t i = 1;
+        for (; i <= nl; i++) {
+            size_t line = j->a + i;
+            if (converge(s, line, sc->states[i])) break;
+            if (line_ready(s, line) && la_at(s, line)->lex_state_start != sc->states[i])
+                la_at(s, line)->dirty = true;
+            ckpt_note(s, line, sc->states[i]);
+        }
+        if (i > nl) set_frontier(s, j->b, st);
+    }
+    if (j->attrs)
+        install_line(s, j->b - 1, sc->attrs, ll, sc->states[nl-1], st, j->approx);
+}
+
+static void scratch_free(SynScratch *sc) {
+    free(sc->text);
+    free(sc->attrs);
+    free(sc->states);
+}
 
-    if (s->search_word[0]) {
-        int qlen=(int)strlen(s->search_word);
-        for (int i=0;i<(int)len-(qlen-1);i++) {
-            if (memcmp(tmp+i, s->search_word, qlen)==0)
-                for(int j=i;j<i+qlen;j++) la->attrs[j]=TOK_SEARCH;
+/* Lex line now, on the calling thread. */
+void syn_ensure_line(SynCtx *s, size_t line, const GapBuf *g, const LineIdx *li) {
+    pthread_mutex_lock(&s->mu);
+    s->g = g; s->li = li;
+    ensure_line_cap(s, line);
+    if (!s->scratch) s->scratch = calloc(1, sizeof *s->scratch);
+    SynJob j;
+    /* A clean line past the frontier may still wait for its state */
+    while (pick_job(s, line, line + 1, false, &j))
+        run_job(s, &j, s->scratch, false);
+    if (line >= li_line_count(li)) la_at(s, line)->dirty = false;
+    pthread_mutex_unlock(&s->mu);
+}
+
+/* ─── Background highlighter ─────────────────────────────────── */
+/* One worker per SynCtx lexes what the screen shows.  Text is copied
+   under the lock and lexed outside it; an edit in between bumps version
+   and the result is dropped.  When the screen is far below the frontier
+   its lines are first lexed from a guessed state (the line above, or 0)
+   and flagged approx, so they can be shown while the frontier catches up
+   and replaces them. */
+
+static void *syn_worker(void *arg) {
+    SynCtx *s = arg;
+    SynScratch sc = {0};
+
+    pthread_mutex_lock(&s->mu);
+    while (!s->quit) {
+        SynJob j;
+        if (!pick_job(s, s->view_lo, s->view_hi, true, &j)) {
+            s->busy = false;
+            pthread_cond_broadcast(&s->done);
+            pthread_cond_wait(&s->wake, &s->mu);
+            continue;
         }
+        run_job(s, &j, &sc, true);
+        pthread_cond_broadcast(&s->done);
     }
+    pthread_mutex_unlock(&s->mu);
+    scratch_free(&sc);
+    return NULL;
+}
 
-    free(tmp);
-    la->dirty = false;
+/* Lines [lo, hi) are on screen.  Points the worker at them, then waits
+   up to wait_ms for each to be lexed (approx counts).  Returns with the
+   lock held: the caller reads s->lines and unlocks when drawn. */
+void syn_view(SynCtx *s, const GapBuf *g, const LineIdx *li,
+              size_t lo, size_t hi, int wait_ms) {
+    pthread_mutex_lock(&s->mu);
+    s->g = g; s->li = li;
+    s->view_lo = lo; s->view_hi = hi;
+    if (hi > lo) ensure_line_cap(s, hi - 1);
+    if (!s->running) {
+        s->running = pthread_create(&s->thread, NULL, syn_worker, s) == 0;
+        if (!s->running) {
+            /* No thread: lex in place */
+            for (size_t i = lo; i < hi; i++) syn_ensure_line(s, i, g, li);
+            return;
+        }
+    }
+    hi = min_sz(hi, li_line_count(li));
+    bool pending = s->frontier < hi;
+    for (size_t i = lo; i < hi && !pending; i++) pending = la_at(s, i)->dirty;
+    if (!pending) return;
+    s->busy = true;
+    pthread_cond_signal(&s->wake);
 
-    if (line+1 < s->count && s->lines[line+1].lex_state_start != ls.state)
-        s->lines[line+1].dirty = true;
-}
\ No newline at end of file
+    struct timespec dl;
+    clock_gettime(CLOCK_REALTIME, &dl);
+    dl.tv_nsec += (long)wait_ms * 1000000L;
+    if (dl.tv_nsec >= 1000000000L) { dl.tv_sec++; dl.tv_nsec -= 1000000000L; }
+    /* Also wait for the frontier to cross the screen, unless it is so far
+       above that approx lines stand in */
+    for (size_t i = lo; i < hi; ) {
+        LineAttr *la = la_at(s, i);
+        bool near = s->frontier < hi && s->frontier + SYN_GUESS_LINES >= lo;
+        if ((!la->dirty || la->approx) && !near) { i++; continue; }
+        if (!s->busy) break;
+        if (pthread_cond_timedwait(&s->done, &s->mu, &dl) != 0) break;
+    }
+}
+
+/* Lines on screen still waiting for their final attrs. */
+bool syn_busy(SynCtx *s) {
+    pthread_mutex_lock(&s->mu);
+    bool busy = s->busy;
+    pthread_mutex_unlock(&s->mu);
+    return busy;
+}
@@ -0,0 +1,250 @@
+/*
+ * check_regex.c  --  regex matches against POSIX regexec
+ *
+ *   make check
+ *
+ * Every match re_search_in finds in random text, and the one regexec
+ * finds from the same offset, must have the same bounds.  The patterns
+ * are ones where the leftmost-first match is also the leftmost-longest
+ * one POSIX asks for.  One text is large enough to overflow the DFA
+ * cache several times over; its matches are worked out by hand.
+ * re_search over a GapBuf split by its gap must agree with re_search_in,
+ * and re_captures must report the groups.  The search overlay's regex
+ * must see past the visible text.
+ */
+/* glibc declares a GNU re_search of its own */
+#define re_search gnu_re_search
+#include <regex.h>
+#undef re_search
+#include "../abyss.h"
+
+static int fails;
+#define CHECK(c) do { if (!(c)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #c); fails++; } } while (0)
+
+static uint64_t rng = 88172645463325252ULL;
+static uint64_t rnd(void) { rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17; return rng; }
+
+/* len random bytes, NUL-terminated: mostly a and b, 1 in x_every an x,
+   1 in nl_every a '\n' */
+static char *random_text(size_t len, unsigned x_every, unsigned nl_every) {
+    char *t = malloc(len + 1);
+    for (size_t i = 0; i < len; i++) {
+        uint64_t r = rnd();
+        t[i] = r % nl_every == 0 ? '\n' : (r >> 20) % x_every == 0 ? 'x' : "ab"[r >> 40 & 1];
+    }
+    t[len] = '\0';
+    return t;
+}
+
+/* Leftmost-longest match of pe starting at or after from.  None of the
+   patterns crosses a '\n', so each line is searched on its own: regexec
+   would otherwise rescan the whole rest of the text every time. */
+static bool posix_search(const regex_t *pe, const char *t, size_t len, size_t from,
+                         size_t *start, size_t *end) {
+    for (size_t lo = from; lo <= len; ) {
+        const char *nl = memchr(t + lo, '\n', len - lo);
+        size_t hi = nl ? (size_t)(nl - t) : len;
+        regmatch_t m = { .rm_so = (regoff_t)lo, .rm_eo = (regoff_t)hi };
+        if (regexec(pe, t, 1, &m, REG_STARTEND) == 0) {
+            *start = (size_t)m.rm_so;
+            *end   = (size_t)m.rm_eo;
+            return true;
+        }
+        lo = hi + 1;
+    }
+    return false;
+}
+
+/* All matches of pat in t, from the engine and from POSIX; false on the
+   first disagreement */
+static bool same_matches(const char *pat, const char *t, size_t len) {
+    const char *err;
+    Regex *re = re_compile(pat, &err);
+    regex_t pe;
+    if (!re || regcomp(&pe, pat, REG_EXTENDED | REG_NEWLINE) != 0) {
+        printf("FAIL %s: does not compile\n", pat);
+        re_free(re);
+        return false;
+    }
+    bool ok = true;
+    for (size_t from = 0; from <= len; ) {
+        size_t s, e, ps, pe_;
+        bool f  = re_search_in(re, t, len, from, &s, &e);
+        bool pf = posix_search(&pe, t, len, from, &ps, &pe_);
+        if (f != pf || (f && (s != ps || e != pe_))) {
+            printf("FAIL %s from %zu: [%zu,%zu) want [%zu,%zu)\n", pat, from,
+                   f ? s : 0, f ? e : 0, pf ? ps : 0, pf ? pe_ : 0);
+            ok = false;
+            break;
+        }
+        if (!f) break;
+        from = e > s ? e : e + 1;
+    }
+    regfree(&pe);
+    re_free(re);
+    return ok;
+}
+
+/* Leftmost-first match of x[ab]*TAIL at or after from, where TAIL is
+   tail with each '?' standing for [ab]: the greedy [ab]* leaves the
+   last place TAIL fits before the run of a/b ends */
+static bool tail_search(const char *tail, const char *t, size_t len, size_t from,
+                        size_t *start, size_t *end) {
+    size_t k = strlen(tail);
+    for (const char *x; from < len && (x = memchr(t + from, 'x', len - from)); ) {
+        size_t i = (size_t)(x - t), r = i + 1;
+        while (r < len && (t[r] == 'a' || t[r] == 'b')) r++;
+        for (size_t e = r; e >= i + 1 + k; e--) {
+            size_t j = 0;
+            while (j < k && (tail[j] == '?' || tail[j] == t[e - k + j])) j++;
+            if (j == k) { *start = i; *end = e; return true; }
+        }
+        from = r;
+    }
+    return false;
+}
+
+/* Long lines of a/b where the DFA meets a new state at nearly every
+   byte: the cache is flushed mid-match, and states numbered before the
+   flush must not be trusted after it.  regexec takes minutes on these,
+   so the matches are worked out directly. */
+static void check_flush(void) {
+    static const struct { const char *pat, *tail; } cases[] = {
+        { "x[ab]*a[ab]{20}",  "a????????????????????" },
+        { "x[ab]*b[ab]{16}a", "b????????????????a" },
+    };
+    size_t len = 8u << 20;
+    char *t = random_text(len, 20000, 200000);
+    for (size_t i = 0; i < sizeof cases / sizeof *cases; i++) {
+        const char *err;
+        Regex *re = re_compile(cases[i].pat, &err);
+        size_t n = 0;
+        for (size_t from = 0; ; n++) {
+            size_t s, e, ws, we;
+            bool f  = re_search_in(re, t, len, from, &s, &e);
+            bool wf = tail_search(cases[i].tail, t, len, from, &ws, &we);
+            if (f != wf || (f && (s != ws || e != we))) {
+                printf("FAIL %s from %zu: [%zu,%zu) want [%zu,%zu)\n", cases[i].pat, from,
+                       f ? s : 0, f ? e : 0, wf ? ws : 0, wf ? we : 0);
+                fails++;
+                break;
+            }
+            if (!f) break;
+            from = e;
+        }
+        CHECK(n > 10);
+        re_free(re);
+    }
+    free(t);
+}
+
+static void check_random(void) {
+    static const char *pats[] = {
+        "a+b", "[ab]*x", "^a", "b$", "^[ab]*$", "x[ab]{2,4}x", "(ab|ba)+",
+        "a[^x\n]*b", "x.*x", "[^a]+", "a{2}|b{3}", "(aa)*b", "b*", "^$",
+        "(a|b)(a|b)x", "a?b?x",
+    };
+    for (int round = 0; round < 300; round++) {
+        size_t len = rnd() % 200;
+        char *t = random_text(len, 6, 12);
+        for (size_t i = 0; i < sizeof pats / sizeof *pats; i++)
+            if (!same_matches(pats[i], t, len)) { fails++; break; }
+        free(t);
+    }
+}
+
+/* The same search through a GapBuf, the gap anywhere */
+static void check_gap(void) {
+    static const char *pats[] = { "a+b", "^b[ab]*x", "x$", "(ab|ba)+x", "b*" };
+    for (int round = 0; round < 200; round++) {
+        size_t len = rnd() % 300;
+        char *t = random_text(len, 6, 12);
+        GapBuf *g = gb_new(GAP_DEFAULT);
+        gb_insert_str(g, 0, t, len);
+        gb_move_gap(g, len ? rnd() % len : 0);
+        for (size_t i = 0; i < sizeof pats / sizeof *pats; i++) {
+            const char *err;
+            Regex *re = re_compile(pats[i], &err);
+            for (size_t from = 0; from <= len; from++) {
+                size_t s, e, gs, ge;
+                bool f  = re_search_in(re, t, len, from, &s, &e);
+                bool gf = re_search(re, g, from, len + 1, &gs, &ge);
+                CHECK(f == gf && (!f || (s == gs && e == ge)));
+            }
+            re_free(re);
+        }
+        gb_free(g);
+        free(t);
+    }
+}
+
+static void check_captures(void) {
+    GapBuf *g = gb_new(GAP_DEFAULT);
+    const char *t = "  key=val; (b)";
+    gb_insert_str(g, 0, t, strlen(t));
+    gb_move_gap(g, 6);
+    const char *err;
+    size_t s, e, caps[8];
+
+    Regex *re = re_compile("(\\w+)=(\\w*)", &err);
+    CHECK(re_groups(re) == 2);
+    CHECK(re_search(re, g, 0, gb_len(g), &s, &e) && s == 2 && e == 9);
+    CHECK(re_captures(re, g, s, e, caps));
+    CHECK(caps[0] == 2 && caps[1] == 9);
+    CHECK(caps[2] == 2 && caps[3] == 5);
+    CHECK(caps[4] == 6 && caps[5] == 9);
+    re_free(re);
+
+    /* A group that took no part, and one that isn't counted */
+    re = re_compile("\\((a)|(?:b)(\\))", &err);
+    CHECK(re_groups(re) == 2);
+    CHECK(re_search(re, g, 0, gb_len(g), &s, &e) && s == 12 && e == 14);
+    CHECK(re_captures(re, g, s, e, caps));
+    CHECK(caps[2] == SIZE_MAX && caps[3] == SIZE_MAX);
+    CHECK(caps[4] == 13 && caps[5] == 14);
+    re_free(re);
+
+    /* The last iteration of a repeated group */
+    re = re_compile("(a|b)+", &err);
+    CHECK(re_search_in(re, "xaab", 4, 0, &s, &e) && s == 1 && e == 4);
+    gb_free(g);
+    g = gb_new(GAP_DEFAULT);
+    gb_insert_str(g, 0, "xaab", 4);
+    CHECK(re_captures(re, g, s, e, caps));
+    CHECK(caps[2] == 3 && caps[3] == 4);
+    re_free(re);
+    gb_free(g);
+}
+
+/* The search overlay only has the visible part of a line as text, but
+   its assertions must see the real bytes around it */
+static void check_overlay(void) {
+    GapBuf *g = gb_new(GAP_DEFAULT);
+    const char *t = "xx ab abc\n";
+    gb_insert_str(g, 0, t, strlen(t));
+    SearchCtx sc = { .regex = true };
+    size_t e;
+    search_start(&sc, "b$");
+    CHECK(search_next_in(&sc, g, 3, t + 3, 2, 0, &e) == 2);      /* "ab" */
+    search_start(&sc, "c$");
+    CHECK(search_next_in(&sc, g, 3, t + 3, 6, 0, &e) == 5 && e == 6);
+    search_start(&sc, "\\bab\\b");
+    CHECK(search_next_in(&sc, g, 3, t + 3, 6, 0, &e) == 0 && e == 2);
+    CHECK(search_next_in(&sc, g, 3, t + 3, 6, 1, &e) == 6);
+    search_start(&sc, "^ab");
+    CHECK(search_next_in(&sc, g, 3, t + 3, 6, 0, &e) == 6);
+    search_start(&sc, "abc");
+    CHECK(search_next_in(&sc, g, 6, t + 6, 2, 0, &e) == 0 && e == 3);
+    search_clear(&sc);
+    gb_free(g);
+}
+
+int main(void) {
+    check_random();
+    check_gap();
+    check_captures();
+    check_overlay();
+    check_flush();
+    printf("%s\n", fails ? "regex: FAILED" : "regex: ok");
+    return fails != 0;
+}
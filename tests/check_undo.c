@@ -0,0 +1,135 @@
+/*
+ * check_undo.c  --  grouped undo steps
+ *
+ *   make check
+ *
+ * Records pushed between us_begin and us_end come back from us_undo and
+ * us_redo as one step, and a beautify, which is recorded as such a
+ * group, is reverted by a single pane_undo.  Trimming old steps drops
+ * whole groups, and a wipe can't be undone.
+ */
+#include "../abyss.h"
+
+static int fails;
+#define CHECK(c) do { if (!(c)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #c); fails++; } } while (0)
+
+/* pane.c hands saves to the editor, which is not linked in */
+void editor_queue_save(const char *path, GapBuf *snap, bool crlf, UjWrite *uj) {
+    us_save_drop(uj); gb_free(snap);
+}
+void editor_drop_saves(const char *path) {}
+
+static char *text(const Pane *p) { return gb_to_str(p->buf); }
+
+static void check_group(void) {
+    GapBuf *g = gb_new(GAP_DEFAULT);
+    UndoStack *us = us_new();
+    size_t n;
+    us_push(us, g, 0, 0, "a", 1, 0, 1);             /* on its own */
+    gb_insert_str(g, 0, "a", 1);
+    us_begin(us);
+    for (size_t i = 1; i < 4; i++) {
+        us_push(us, g, i, 0, "b", 1, i, i + 1);
+        gb_insert_str(g, i, "b", 1);
+    }
+    us_end(us);
+    CHECK(us_undo(us, &n) && n == 3);
+    CHECK(us_undo(us, &n) && n == 1);
+    CHECK(!us_undo(us, &n));
+    CHECK(us_redo(us, &n) && n == 1);
+    CHECK(us_redo(us, &n) && n == 3);
+    CHECK(!us_redo(us, &n));
+    us_free(us);
+    gb_free(g);
+}
+
+/* Trimming the oldest steps never leaves part of a group, even one
+   longer than the whole stack (512 records) */
+static void check_trim(void) {
+    GapBuf *g = gb_new(GAP_DEFAULT);
+    UndoStack *us = us_new();
+    size_t n;
+    us_begin(us);
+    for (int i = 0; i < 20; i++) us_push(us, g, 0, 0, "a", 1, 0, 0);
+    us_end(us);
+    for (int i = 0; i < 500; i++) us_push(us, g, 0, 0, "b", 1, 0, 0);
+    while (us_undo(us, &n)) CHECK(n == 1 || n == 20);
+    us_free(us);
+
+    us = us_new();
+    us_push(us, g, 0, 0, "a", 1, 0, 0);
+    us_begin(us);
+    for (int i = 0; i < 600; i++) us_push(us, g, 0, 0, "b", 1, 0, 0);
+    us_end(us);
+    CHECK(us_undo(us, &n) && n == 600);
+    us_free(us);
+    gb_free(g);
+}
+
+static void check_beautify(void) {
+    static const char src[] =
+        "int a; // one\n"
+        "/* two */ int b;\n"
+        "int c; // three\n"
+        "char *s = \"// not a comment\";\n";
+    Pane *p = pane_new();
+    gb_insert_str(p->buf, 0, src, sizeof src - 1);
+    li_rebuild(p->li, p->buf);
+    p->cursor = sizeof src - 1;
+    pane_beautify(p);
+    char *after = text(p);
+    CHECK(strcmp(after, src) && !strstr(after, "one") && strstr(after, "\"// not a comment\""));
+    CHECK(p->cursor == strlen(after));
+
+    pane_undo(p);
+    char *undone = text(p);
+    CHECK(!strcmp(undone, src));
+    CHECK(p->cursor == sizeof src - 1);
+    pane_redo(p);
+    char *redone = text(p);
+    CHECK(!strcmp(redone, after));
+    free(after); free(undone); free(redone);
+    pane_free(p);
+}
+
+/* More comments than undo records per beautify: hunks get merged */
+static void check_beautify_many(void) {
+    Pane *p = pane_new();
+    char line[64];
+    for (int i = 0; i < 2000; i++) {
+        int n = snprintf(line, sizeof line, "x%d = %d; /* c%d */ y; // d\n", i, i, i);
+        gb_insert_str(p->buf, gb_len(p->buf), line, (size_t)n);
+    }
+    li_rebuild(p->li, p->buf);
+    char *src = text(p);
+    pane_beautify(p);
+    char *after = text(p);
+    CHECK(!strstr(after, "/*") && strlen(after) < strlen(src));
+    free(after);
+    pane_undo(p);
+    char *undone = text(p);
+    CHECK(!strcmp(undone, src));
+    free(src); free(undone);
+    pane_free(p);
+}
+
+/* A wipe empties the buffer and leaves nothing to undo */
+static void check_wipe(void) {
+    Pane *p = pane_new();
+    pane_insert_str(p, "secret\n", 7);
+    pane_wipe_file(p);
+    CHECK(gb_len(p->buf) == 0 && p->undo->count == 0);
+    pane_undo(p);
+    CHECK(gb_len(p->buf) == 0);
+    pane_free(p);
+}
+
+int main(void) {
+    check_group();
+    check_trim();
+    check_beautify();
+    check_beautify_many();
+    check_wipe();
+    printf("%s\n", fails ? "undo: FAILED" : "undo: ok");
+    return fails != 0;
+}
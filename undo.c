@@ -1,76 +1,562 @@
 #include "abyss.h"
 
-/* Forward-declare clone (defined in gap_buf.c) */
-GapBuf *gb_clone(const GapBuf *g);
+/* Undo is an operation log: each record holds the bytes an edit removed
+   and inserted, never a copy of the buffer.  Record text lives in an
+   arena; dropping the redo tail releases it, and trimmed records are
+   reclaimed by compacting once dead text outweighs live text.
+
+   Keystrokes coalesce: a typed edit that continues the newest typed
+   record within UNDO_COALESCE_MS, and does not start a new word, is
+   folded into it.  Records pushed inside us_begin()/us_end() are chained
+   so one undo reverts the whole transaction.
+
+   History survives the session in a per-file journal (see below). */
 
 #define MAX_UNDO_DEPTH 512
+#define UNDO_ARENA     65536
+
+static void uj_check_end(UndoStack *us, bool adopt);
 
 UndoStack *us_new(void) {
     UndoStack *us = calloc(1, sizeof *us);
+    us->cap   = 64;
+    us->recs  = malloc(us->cap * sizeof(UndoRec));
+    us->arena = arena_new(UNDO_ARENA);
     return us;
 }
 
-static void ua_free(UndoAction *a) {
-    if (!a) return;
-    gb_free(a->snapshot_buf);
-    free(a);
-}
-
 void us_free(UndoStack *us) {
     if (!us) return;
-    UndoAction *a = us->head;
-    while (a) {
-        UndoAction *n = a->next;
-        ua_free(a);
-        a = n;
-    }
+    if (us->check) uj_check_end(us, false);
+    if (us->jmap) munmap((void *)us->jmap, us->jmap_len);
+    arena_free(us->arena);
+    free(us->recs);
     free(us);
 }
 
-void us_push(UndoStack *us, const GapBuf *g, size_t cursor) {
+static long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+static bool is_word(char c) {
+    return isalnum((unsigned char)c) || c == '_' || (c & 0x80);
+}
+
+static char *us_copy(UndoStack *us, const char *s, size_t n) {
+    if (!n) return NULL;
+    char *d = arena_alloc(us->arena, n);
+    memcpy(d, s, n);
+    us->used += n;
+    return d;
+}
+
+/* Move live record text into a fresh arena, leaving trimmed text behind.
+   Text restored from the journal stays in its mapping. */
+static void us_compact(UndoStack *us) {
+    UndoStack tmp = { .arena = arena_new(UNDO_ARENA) };
+    for (size_t i = 0; i < us->count; i++) {
+        UndoRec *r = &us->recs[i];
+        r->mark = arena_mark(tmp.arena);
+        if (!r->size) continue;
+        r->del  = us_copy(&tmp, r->del, r->del_len);
+        r->ins  = us_copy(&tmp, r->ins, r->ins_len);
+        r->size = r->del_len + r->ins_len;
+        r->cap  = 0;
+    }
+    arena_free(us->arena);
+    us->arena = tmp.arena;
+    us->used  = tmp.used;
+}
+
+/* Record replacing [pos, pos+del) of g by ins[0..ins_len).  Must be called
+   before the edit is applied, since the removed bytes are read from g. */
+void us_push(UndoStack *us, const GapBuf *g, size_t pos, size_t del,
+             const char *ins, size_t ins_len,
+             size_t cursor_before, size_t cursor_after) {
     /* Discard redo history */
-    if (us->current) {
-        UndoAction *a = us->current->next;
-        while (a) {
-            UndoAction *n = a->next;
-            ua_free(a);
-            a = n;
+    if (us->current < us->count) {
+        size_t dropped = 0, freed = 0;
+        for (size_t i = us->current; i < us->count; i++) {
+            dropped += us->recs[i].del_len + us->recs[i].ins_len;
+            freed   += us->recs[i].size;
         }
-        us->current->next = NULL;
-    }
-
-    UndoAction *ua = calloc(1, sizeof *ua);
-    ua->snapshot_buf = gb_clone(g);
-    ua->cursor_pos = cursor;
-    ua->prev = us->current;
-    if (us->current) us->current->next = ua;
-    else us->head = ua;
-    us->current = ua;
-
-    us->depth++;
-    /* Trim oldest entries if too deep */
-    if (us->depth > MAX_UNDO_DEPTH) {
-        UndoAction *old = us->head;
-        us->head = old->next;
-        if (us->head) us->head->prev = NULL;
-        ua_free(old);
-        us->depth--;
-    }
-}
-
-bool us_undo(UndoStack *us, GapBuf **g_out, size_t *cursor_out) {
-    if (!us->current) return false;
-    *g_out = gb_clone(us->current->snapshot_buf);
-    *cursor_out = us->current->cursor_pos;
-    if (us->current->prev)
-        us->current = us->current->prev;
+        arena_release(us->arena, us->recs[us->current].mark);
+        us->live -= dropped;
+        us->used -= freed;
+        us->count = us->current;
+        if (us->synced > us->count) us->synced = us->count;
+    }
+    /* Trim the oldest steps if too deep, whole groups only so that none
+       is left to undo in part.  A group reaching back to the oldest
+       record is still being recorded: the stack grows until it ends. */
+    while (us->count >= MAX_UNDO_DEPTH) {
+        size_t k = 1;
+        while (k < us->count && us->recs[k].chain) k++;
+        if (k == us->count) break;
+        for (size_t i = 0; i < k; i++)
+            us->live -= us->recs[i].del_len + us->recs[i].ins_len;
+        memmove(us->recs, us->recs + k, (us->count - k) * sizeof(UndoRec));
+        us->count -= k;
+        us->group  = us->group  > k ? us->group  - k : 0;
+        us->synced = us->synced > k ? us->synced - k : 0;
+        us->base  += k;
+        if (us->used > 2 * us->live + UNDO_ARENA) us_compact(us);
+    }
+    if (us->count == us->cap) {
+        us->cap *= 2;
+        us->recs = realloc(us->recs, us->cap * sizeof(UndoRec));
+    }
+
+    UndoRec *r = &us->recs[us->count++];
+    r->mark = arena_mark(us->arena);
+    r->pos  = pos;
+    r->del_len = del;
+    r->del  = NULL;
+    if (del) {
+        r->del = arena_alloc(us->arena, del);
+        gb_get_range(g, pos, del, r->del);
+        us->used += del;
+    }
+    r->ins_len = ins_len;
+    r->ins  = us_copy(us, ins, ins_len);
+    r->cursor_before = cursor_before;
+    r->cursor_after  = cursor_after;
+    r->size  = del + ins_len;
+    r->cap   = 0;
+    r->typed = false;
+    r->chain = us->depth > 0 && us->count - 1 > us->group;
+    us->live += del + ins_len;
+    us->current = us->count;
+}
+
+/* Make room for n more bytes in the extendable text of r. */
+static char *us_grow(UndoStack *us, UndoRec *r, char *text, size_t len, size_t n) {
+    if (len + n <= r->cap) return text;
+    r->cap = 2 * (len + n);
+    char *t = arena_alloc(us->arena, r->cap);
+    memcpy(t, text, len);
+    r->size  += r->cap;
+    us->used += r->cap;
+    return t;
+}
+
+/* Like us_push, but folds the edit into the newest record when it is a
+   continuation of the same typing or deleting run. */
+void us_type(UndoStack *us, const GapBuf *g, size_t pos, size_t del,
+             const char *ins, size_t ins_len,
+             size_t cursor_before, size_t cursor_after) {
+    long now = now_ms();
+    UndoRec *r = us->count > 0 && us->current == us->count
+               ? &us->recs[us->count - 1] : NULL;
+    bool warm = r && r->typed && now - us->last_ms <= UNDO_COALESCE_MS;
+
+    if (warm && !del && ins_len && !r->del_len && pos == r->pos + r->ins_len
+            && !memchr(ins, '\n', ins_len)
+            && !(is_word(ins[0]) && !is_word(r->ins[r->ins_len - 1]))) {
+        /* Typing on: append */
+        r->ins = us_grow(us, r, r->ins, r->ins_len, ins_len);
+        memcpy(r->ins + r->ins_len, ins, ins_len);
+        r->ins_len += ins_len;
+    } else if (warm && del && !ins_len && !r->ins_len && pos + del == r->pos
+            && !(!is_word(gb_at(g, pos + del - 1)) && is_word(r->del[0]))) {
+        /* Backspacing on: prepend */
+        r->del = us_grow(us, r, r->del, r->del_len, del);
+        memmove(r->del + del, r->del, r->del_len);
+        gb_get_range(g, pos, del, r->del);
+        r->del_len += del;
+        r->pos = pos;
+    } else if (warm && del && !ins_len && !r->ins_len && pos == r->pos
+            && !(is_word(gb_at(g, pos)) && !is_word(r->del[r->del_len - 1]))) {
+        /* Deleting forward: append */
+        r->del = us_grow(us, r, r->del, r->del_len, del);
+        gb_get_range(g, pos, del, r->del + r->del_len);
+        r->del_len += del;
+    } else {
+        us_push(us, g, pos, del, ins, ins_len, cursor_before, cursor_after);
+        us->recs[us->count - 1].typed = true;
+        us->last_ms = now;
+        return;
+    }
+    r->cursor_after = cursor_after;
+    us->live += del + ins_len;
+    us->last_ms = now;
+    if (us->synced == us->count) us->synced--;
+}
+
+/* Group every record pushed until the matching us_end into one step. */
+void us_begin(UndoStack *us) {
+    if (us->depth++ == 0) us->group = us->current;
+    us->last_ms = 0;
+}
+
+void us_end(UndoStack *us) {
+    if (us->depth > 0) us->depth--;
+    us->last_ms = 0;
+}
+
+/* Records to revert, last first (replace ins by del at pos), or NULL. */
+const UndoRec *us_undo(UndoStack *us, size_t *n) {
+    if (us->current == 0) return NULL;
+    size_t end = us->current, start = end - 1;
+    while (start > 0 && us->recs[start].chain) start--;
+    us->current = start;
+    us->last_ms = 0;
+    *n = end - start;
+    return &us->recs[start];
+}
+
+/* Records to re-apply, first first (replace del by ins at pos), or NULL. */
+const UndoRec *us_redo(UndoStack *us, size_t *n) {
+    if (us->current == us->count) return NULL;
+    size_t start = us->current, end = start + 1;
+    while (end < us->count && us->recs[end].chain) end++;
+    us->current = end;
+    us->last_ms = 0;
+    *n = end - start;
+    return &us->recs[start];
+}
+
+/* ─── Persistent journal ─────────────────────────────────────── */
+/* One journal per file under $XDG_CACHE_HOME/abyss/undo, named after a
+   hash of its path.  Each save appends the records changed since the
+   previous save, then a save frame with the record count, the current
+   position and a hash of the saved text.  Reopening replays the frames
+   up to the last save frame, provided the file still has that content;
+   the header caches the file's inode and mtime from the last save so a
+   matching file is not rehashed.  Restored record text is never copied:
+   it points into the journal mapping and pages in when undo reaches it. */
+
+#define UJ_MAGIC  "ABYSSUJ1"
+#define UJ_REC    1
+#define UJ_SAVE   2
+#define UJ_SLACK  (1 << 20)
+
+typedef struct {
+    char     magic[8];
+    uint64_t dev, ino, size;   /* the file as written by a save ... */
+    int64_t  mtime_ns;
+    uint64_t hash;             /* ... whose content hash is this */
+} UjHeader;
+
+/* Record frames are followed by del_len then ins_len bytes of text. */
+typedef struct {
+    uint32_t kind;
+    uint32_t chain;
+    uint64_t seq;              /* REC: record index  SAVE: record count */
+    uint64_t pos;              /* SAVE: current */
+    uint64_t del_len;          /* SAVE: text length */
+    uint64_t ins_len;
+    uint64_t cursor_before;
+    uint64_t cursor_after;
+    uint64_t hash;             /* SAVE: text hash */
+} UjFrame;
+
+static uint64_t fnv(uint64_t h, const char *s, size_t n) {
+    for (size_t i = 0; i < n; i++) { h ^= (unsigned char)s[i]; h *= 0x100000001b3ULL; }
+    return h;
+}
+
+/* Hash of the text of g; stops early (with a useless hash) once *cancel
+   is set.  Only ever run off the UI thread: it reads every byte. */
+static uint64_t uj_hash(const GapBuf *g, const bool *cancel) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    size_t len = gb_len(g);
+    for (size_t pos = 0; pos < len; ) {
+        if (cancel && __atomic_load_n(cancel, __ATOMIC_RELAXED)) break;
+        const char *c;
+        size_t n = gb_chunk(g, pos, &c);
+        h = fnv(h, c, n);
+        pos += n;
+    }
+    return h;
+}
+
+static bool uj_path(const char *file, char *out, size_t cap, bool create) {
+    const char *xdg = getenv("XDG_CACHE_HOME"), *home = getenv("HOME");
+    char dir[4096];
+    if (xdg && xdg[0]) snprintf(dir, sizeof dir, "%s/abyss/undo", xdg);
+    else if (home)     snprintf(dir, sizeof dir, "%s/.cache/abyss/undo", home);
+    else return false;
+    if (create) {
+        for (char *s = dir + 1; *s; s++)
+            if (*s == '/') { *s = '\0'; mkdir(dir, 0700); *s = '/'; }
+        mkdir(dir, 0700);
+    }
+    uint64_t h = fnv(0xcbf29ce484222325ULL, file, strlen(file));
+    snprintf(out, cap, "%s/%016llx.undo", dir, (unsigned long long)h);
     return true;
 }
 
-bool us_redo(UndoStack *us, GapBuf **g_out, size_t *cursor_out) {
-    if (!us->current || !us->current->next) return false;
-    us->current = us->current->next;
-    *g_out = gb_clone(us->current->snapshot_buf);
-    *cursor_out = us->current->cursor_pos;
+static void uj_put_rec(FILE *f, const UndoRec *r, size_t seq) {
+    UjFrame fr = { UJ_REC, r->chain, seq, r->pos, r->del_len, r->ins_len,
+                   r->cursor_before, r->cursor_after, 0 };
+    fwrite(&fr, sizeof fr, 1, f);
+    if (r->del_len) fwrite(r->del, 1, r->del_len, f);
+    if (r->ins_len) fwrite(r->ins, 1, r->ins_len, f);
+}
+
+/* Adopt the records of the journal mapping m up to its save frame last,
+   which ends at end.  Returns false if they don't make a usable history. */
+static bool uj_adopt(UndoStack *us, const char *m, size_t jlen, size_t end,
+                     const UjFrame *last) {
+    UjFrame fr;
+    /* Latest frame for every record index up to that save */
+    size_t n = last->seq, cur = last->pos;
+    size_t *offs = calloc(n + 1, sizeof *offs);
+    for (size_t off = sizeof(UjHeader); off < end; ) {
+        memcpy(&fr, m + off, sizeof fr);
+        if (fr.kind == UJ_REC && fr.seq < n) offs[fr.seq] = off;
+        off += sizeof fr + (fr.kind == UJ_REC ? fr.del_len + fr.ins_len : 0);
+    }
+    size_t lo = n;
+    while (lo > 0 && offs[lo-1]) lo--;
+    if (cur < lo) { free(offs); return false; }
+    size_t start = n > MAX_UNDO_DEPTH ? n - MAX_UNDO_DEPTH : 0;
+    if (start < lo)  start = lo;
+    if (start > cur) start = cur;
+    /* Never start inside a group */
+    for (; start < cur; start++) {
+        memcpy(&fr, m + offs[start], sizeof fr);
+        if (!fr.chain) break;
+    }
+    size_t stop = min_sz(n, start + MAX_UNDO_DEPTH);
+
+    if (stop - start > us->cap) {
+        us->cap  = stop - start;
+        us->recs = realloc(us->recs, us->cap * sizeof(UndoRec));
+    }
+    ArenaMark mark = arena_mark(us->arena);
+    for (size_t i = start; i < stop; i++) {
+        memcpy(&fr, m + offs[i], sizeof fr);
+        const char *text = m + offs[i] + sizeof fr;
+        us->recs[i - start] = (UndoRec){
+            .pos = fr.pos,
+            .del = fr.del_len ? (char *)text : NULL,               .del_len = fr.del_len,
+            .ins = fr.ins_len ? (char *)text + fr.del_len : NULL,  .ins_len = fr.ins_len,
+            .cursor_before = fr.cursor_before, .cursor_after = fr.cursor_after,
+            .mark = mark, .chain = i > start && fr.chain,
+        };
+        us->live += fr.del_len + fr.ins_len;
+    }
+    free(offs);
+    us->count     = stop - start;
+    us->current   = cur - start;
+    us->base      = start;
+    us->synced    = us->count;
+    us->journaled = true;
+    us->jmap      = m;
+    us->jmap_len  = jlen;
     return true;
-}
\ No newline at end of file
+}
+
+/* A journal whose file changed identity: the text is hashed on a thread
+   and us_poll adopts the history if it still matches. */
+typedef struct UjCheck {
+    pthread_t   thread;
+    GapBuf     *snap;
+    const char *m;
+    size_t      jlen, end;
+    UjFrame     last;
+    uint64_t    hash;
+    bool        done, cancel;
+} UjCheck;
+
+static void *uj_check_thread(void *arg) {
+    UjCheck *c = arg;
+    c->hash = uj_hash(c->snap, &c->cancel);
+    __atomic_store_n(&c->done, true, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/* Finish the check in flight, adopting its history if asked and it
+   matched. */
+static void uj_check_end(UndoStack *us, bool adopt) {
+    UjCheck *c = us->check;
+    if (!adopt) __atomic_store_n(&c->cancel, true, __ATOMIC_RELAXED);
+    pthread_join(c->thread, NULL);
+    us->check = NULL;
+    if (!adopt || c->hash != c->last.hash || us->count ||
+        !uj_adopt(us, c->m, c->jlen, c->end, &c->last))
+        munmap((void *)c->m, c->jlen);
+    gb_free(c->snap);
+    free(c);
+}
+
+/* Call once per frame.  Returns true while a us_load check is running;
+   an edit made meanwhile means the history is dropped. */
+bool us_poll(UndoStack *us) {
+    if (!us->check) return false;
+    if (!__atomic_load_n(&us->check->done, __ATOMIC_ACQUIRE)) return true;
+    uj_check_end(us, true);
+    return false;
+}
+
+/* Restore the history saved for path if g still holds the saved text.
+   us must be fresh.  When the file's identity no longer matches the
+   journal header the text must be hashed, which happens in the
+   background (see us_poll). */
+void us_load(UndoStack *us, const char *path, const GapBuf *g) {
+    char jp[4200];
+    if (!uj_path(path, jp, sizeof jp, false)) return;
+    int fd = open(jp, O_RDONLY);
+    if (fd < 0) return;
+    struct stat js;
+    if (fstat(fd, &js) != 0 || (size_t)js.st_size < sizeof(UjHeader)) { close(fd); return; }
+    size_t jlen = (size_t)js.st_size;
+    const char *m = mmap(NULL, jlen, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) return;
+
+    UjHeader h; memcpy(&h, m, sizeof h);
+    UjFrame fr, last = {0};
+    size_t end = 0;
+    for (size_t off = sizeof h; off + sizeof fr <= jlen; ) {
+        memcpy(&fr, m + off, sizeof fr);
+        size_t step = sizeof fr;
+        if (fr.kind == UJ_REC) {
+            if (fr.del_len > jlen || fr.ins_len > jlen) break;
+            step += fr.del_len + fr.ins_len;
+        } else if (fr.kind != UJ_SAVE) break;
+        if (step > jlen - off) break;
+        off += step;
+        if (fr.kind == UJ_SAVE) { last = fr; end = off; }
+    }
+    if (memcmp(h.magic, UJ_MAGIC, 8) != 0 || !end ||
+        last.del_len != gb_len(g) || last.pos > last.seq) goto drop;
+
+    struct stat fs;
+    bool same = stat(path, &fs) == 0 && h.hash == last.hash &&
+                h.dev == (uint64_t)fs.st_dev && h.ino == (uint64_t)fs.st_ino &&
+                h.size == (uint64_t)fs.st_size &&
+                h.mtime_ns == (int64_t)fs.st_mtim.tv_sec * 1000000000 + fs.st_mtim.tv_nsec;
+    if (same) {
+        if (uj_adopt(us, m, jlen, end, &last)) return;
+        goto drop;
+    }
+    UjCheck *c = calloc(1, sizeof *c);
+    *c = (UjCheck){ .snap = gb_clone(g), .m = m, .jlen = jlen, .end = end, .last = last };
+    if (pthread_create(&c->thread, NULL, uj_check_thread, c) != 0) {
+        gb_free(c->snap);
+        free(c);
+        goto drop;
+    }
+    us->check = c;
+    return;
+drop:
+    munmap((void *)m, jlen);
+}
+
+/* Journal frames of one save, written by the save thread once the file
+   is on disk; the save frame at the end still lacks the text hash. */
+struct UjWrite {
+    char    jp[4200];
+    bool    rewrite;         /* replace the journal rather than append */
+    char   *buf;
+    size_t  len;
+};
+
+/* Journal the history of g, about to be saved to path: the records
+   changed since the last call, or the whole history when the journal is
+   stale or mostly dead.  Only the frames are built here; us_save_finish
+   hashes the text and writes them from the save thread. */
+UjWrite *us_save(UndoStack *us, const char *path, const GapBuf *g) {
+    if (us->check) uj_check_end(us, false);   /* about to be superseded */
+    UjWrite *w = calloc(1, sizeof *w);
+    if (!uj_path(path, w->jp, sizeof w->jp, true)) { free(w); return NULL; }
+    struct stat st;
+    w->rewrite = !us->journaled || stat(w->jp, &st) != 0 ||
+        (size_t)st.st_size > 2 * (us->live + us->count * sizeof(UjFrame)) + UJ_SLACK;
+    size_t base = w->rewrite ? 0 : us->base, from = w->rewrite ? 0 : us->synced;
+
+    FILE *f = open_memstream(&w->buf, &w->len);
+    if (!f) { free(w); us->journaled = false; return NULL; }
+    if (w->rewrite) {
+        UjHeader h = {0};
+        memcpy(h.magic, UJ_MAGIC, 8);
+        fwrite(&h, sizeof h, 1, f);
+    }
+    for (size_t i = from; i < us->count; i++)
+        uj_put_rec(f, &us->recs[i], base + i);
+    UjFrame sv = { UJ_SAVE, 0, base + us->count, base + us->current,
+                   gb_len(g), 0, 0, 0, 0 };
+    fwrite(&sv, sizeof sv, 1, f);
+    if (fclose(f) != 0) { free(w->buf); free(w); us->journaled = false; return NULL; }
+
+    /* Assumed written; if it isn't, the save thread removes the journal
+       and the next save starts a new one */
+    us->journaled = true;
+    us->base   = base;
+    us->synced = us->count;
+    return w;
+}
+
+/* w supersedes the queued older save of the same file, whose text will
+   never be written: keep older's records ahead of w's frames. */
+UjWrite *us_save_merge(UjWrite *older, UjWrite *w) {
+    if (!older) return w;
+    if (!w || w->rewrite) { us_save_drop(older); return w; }
+    size_t keep = older->len - sizeof(UjFrame);
+    older->buf = realloc(older->buf, keep + w->len);
+    memcpy(older->buf + keep, w->buf, w->len);
+    older->len = keep + w->len;
+    us_save_drop(w);
+    return older;
+}
+
+void us_save_drop(UjWrite *w) {
+    if (!w) return;
+    free(w->buf);
+    free(w);
+}
+
+/* Record that path now holds the text hashed into its last save frame,
+   so the next load can trust the file's identity instead of rehashing. */
+static void us_stamp(const char *jp, const char *path, uint64_t hash) {
+    struct stat st;
+    if (stat(path, &st) != 0) return;
+    int fd = open(jp, O_WRONLY);
+    if (fd < 0) return;
+    UjHeader h = { .dev = st.st_dev, .ino = st.st_ino, .size = st.st_size,
+                   .mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec,
+                   .hash = hash };
+    memcpy(h.magic, UJ_MAGIC, 8);
+    ssize_t _w = pwrite(fd, &h, sizeof h, 0); (void)_w;
+    close(fd);
+}
+
+/* On the save thread, after snap was written to path (or failed to be):
+   hash snap into the save frame, write the journal and stamp it.  A
+   journal that cannot be brought up to date is removed.  Frees w. */
+void us_save_finish(UjWrite *w, const char *path, const GapBuf *snap, bool saved) {
+    if (!w) return;
+    char tmp[4300];
+    snprintf(tmp, sizeof tmp, "%s.tmp", w->jp);
+    bool ok = saved;
+    if (ok) {
+        uint64_t hash = uj_hash(snap, NULL);
+        memcpy(w->buf + w->len - sizeof hash, &hash, sizeof hash);
+        int fd = w->rewrite ? open(tmp,  O_WRONLY | O_CREAT | O_TRUNC, 0600)
+                            : open(w->jp, O_WRONLY | O_APPEND);
+        ok = fd >= 0;
+        for (size_t off = 0; ok && off < w->len; ) {
+            ssize_t n = write(fd, w->buf + off, w->len - off);
+            if (n <= 0) ok = false;
+            else off += (size_t)n;
+        }
+        if (fd >= 0 && close(fd) != 0) ok = false;
+        if (ok && w->rewrite && rename(tmp, w->jp) != 0) ok = false;
+        if (ok) us_stamp(w->jp, path, hash);
+    }
+    if (!ok) {
+        if (w->rewrite) unlink(tmp);
+        unlink(w->jp);
+    }
+    us_save_drop(w);
+}
+
+void us_forget(const char *path) {
+    char jp[4200];
+    if (uj_path(path, jp, sizeof jp, false)) unlink(jp);
+}